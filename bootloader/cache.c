@@ -0,0 +1,292 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "common.h"
+#include "cache.h"
+#include "error.h"
+#include "index.h"
+#include "util.h"
+
+/**
+ * The extraction cache lets a bundle be extracted (and patched) once, and
+ * then re-used by every later run. Each bundle gets its own directory, named
+ * after the digest of its contents recorded by the builder:
+ *
+ *      $XDG_CACHE_HOME/staticx/<digest>/
+ *
+ * An entry is first extracted into a private temporary directory next to
+ * its final location, and then atomically renamed into place. So any entry
+ * that exists is complete, and concurrent first runs don't interfere.
+ *
+ * An entry whose members were all checked against the archive index as it
+ * was populated (see the "verify" option) records that as an empty file:
+ *
+ *      $XDG_CACHE_HOME/staticx/<digest>/.staticx.verified
+ *
+ * The cache root also holds the shared library store (see store.c):
+ *
+ *      $XDG_CACHE_HOME/staticx/store/
+ */
+
+#define VERIFIED_FILENAME   ".staticx.verified"
+
+static char *
+cache_root(void)
+{
+    char *result;
+
+    const char *xdg_cache = getenv("XDG_CACHE_HOME");
+    if (xdg_cache && xdg_cache[0] == '/')
+        return path_join(xdg_cache, "staticx");
+
+    const char *home = getenv("HOME");
+    if (home && home[0] == '/') {
+        if (asprintf(&result, "%s/.cache/staticx", home) < 0)
+            error(2, 0, "Failed to allocate path string");
+        return result;
+    }
+
+    if (asprintf(&result, "/var/tmp/staticx-%ld", (long)geteuid()) < 0)
+        error(2, 0, "Failed to allocate path string");
+    return result;
+}
+
+/**
+ * Verify that a path is a directory owned by us, which no one else can write.
+ * Anything else (e.g. a directory planted in /var/tmp by another user) must
+ * not be trusted, as we would be executing its contents.
+ */
+static bool
+is_private_dir(const char *path)
+{
+    struct stat st;
+
+    if (lstat(path, &st) < 0)
+        return false;
+
+    if (!S_ISDIR(st.st_mode)) {
+        debug_printf("Cache: %s is not a directory\n", path);
+        return false;
+    }
+
+    if (st.st_uid != geteuid()) {
+        debug_printf("Cache: %s is not owned by us\n", path);
+        return false;
+    }
+
+    if (st.st_mode & (S_IWGRP | S_IWOTH)) {
+        debug_printf("Cache: %s is writable by others\n", path);
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * Get the path of the cache directory for the bundle with the given digest.
+ *
+ * Returns NULL if no usable cache root is available.
+ */
+char *
+cache_get_dir(const char *digest)
+{
+    char *root = cache_root();
+
+    if (mkdir_p(root, 0700) < 0) {
+        debug_printf("Cache: Failed to create %s: %m\n", root);
+        free(root);
+        return NULL;
+    }
+
+    if (!is_private_dir(root)) {
+        free(root);
+        return NULL;
+    }
+
+    char *dir = path_join(root, digest);
+    free(root);
+    return dir;
+}
+
+/**
+ * Get the path of the shared library store, creating it if necessary.
+ *
+ * Returns NULL if no usable store is available.
+ */
+char *
+cache_get_store(void)
+{
+    char *dir = cache_get_dir("store");
+    if (!dir)
+        return NULL;
+
+    if (mkdir(dir, 0700) < 0 && errno != EEXIST) {
+        debug_printf("Cache: Failed to create %s: %m\n", dir);
+        free(dir);
+        return NULL;
+    }
+
+    if (!is_private_dir(dir)) {
+        free(dir);
+        return NULL;
+    }
+
+    return dir;
+}
+
+/**
+ * Determine whether every member in idx is still present in a cache
+ * directory, as extracted: it exists (following symlinks, which may point to
+ * the shared store), and a regular file has its recorded size. Something
+ * (e.g. a tmp cleaner) may have removed or truncated some of them.
+ */
+static bool
+members_present(const char *dir, const struct archive_index *idx)
+{
+    int dirfd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dirfd < 0)
+        return false;
+
+    bool result = true;
+    for (size_t i = 0; i < idx->count && result; i++) {
+        const struct archive_member *m = &idx->members[i];
+        struct stat st;
+
+        if (fstatat(dirfd, m->name, &st, 0) < 0) {
+            debug_printf("Cache: %s/%s is missing\n", dir, m->name);
+            result = false;
+        }
+        else if ((m->flags & MEMBER_SIZE)
+                && (!S_ISREG(st.st_mode) || (size_t)st.st_size != m->size)) {
+            debug_printf("Cache: %s/%s is not the size extracted\n", dir, m->name);
+            result = false;
+        }
+    }
+
+    close(dirfd);
+    return result;
+}
+
+/**
+ * Determine whether a cache directory contains a usable extracted bundle,
+ * with all of the members in idx (if given).
+ */
+bool
+cache_dir_valid(const char *dir, const struct archive_index *idx)
+{
+    if (!is_private_dir(dir))
+        return false;
+
+    char *prog_path = path_join(dir, PROG_FILENAME);
+    bool result = (access(prog_path, X_OK) == 0);
+    free(prog_path);
+
+    if (result && idx)
+        result = members_present(dir, idx);
+
+    return result;
+}
+
+/**
+ * Create a temporary directory in which to populate the cache directory.
+ *
+ * Returns NULL if the directory cannot be created.
+ */
+char *
+cache_create_tmpdir(const char *dir)
+{
+    char *template;
+    if (asprintf(&template, "%s.tmp-XXXXXX", dir) < 0)
+        error(2, 0, "Failed to allocate path string");
+
+    if (!mkdtemp(template)) {
+        debug_printf("Cache: Failed to create %s: %m\n", template);
+        free(template);
+        return NULL;
+    }
+
+    return template;
+}
+
+/**
+ * Move a fully-populated temporary directory into its place in the cache.
+ * idx is as for cache_dir_valid().
+ */
+void
+cache_commit(const char *tmpdir, const char *dir, const struct archive_index *idx)
+{
+    if (rename(tmpdir, dir) == 0) {
+        debug_printf("Cache: Populated %s\n", dir);
+        return;
+    }
+
+    if (errno != EEXIST && errno != ENOTEMPTY)
+        error(2, errno, "Failed to rename %s to %s", tmpdir, dir);
+
+    /* Another instance populated it first; use theirs */
+    if (cache_dir_valid(dir, idx)) {
+        debug_printf("Cache: Lost race to populate %s\n", dir);
+        if (remove_tree(tmpdir) < 0)
+            fprintf(stderr, "staticx: Failed to cleanup %s: %m\n", tmpdir);
+        return;
+    }
+
+    /* The existing entry is broken; replace it */
+    debug_printf("Cache: Replacing invalid %s\n", dir);
+    if (remove_tree(dir) < 0)
+        error(2, errno, "Failed to remove invalid cache dir %s", dir);
+    if (rename(tmpdir, dir) < 0)
+        error(2, errno, "Failed to rename %s to %s", tmpdir, dir);
+}
+
+static bool
+marker_exists(const char *path)
+{
+    struct stat st;
+    return lstat(path, &st) == 0 && S_ISREG(st.st_mode)
+           && st.st_uid == geteuid();
+}
+
+static void
+create_marker(const char *path)
+{
+    int fd = open(path, O_WRONLY | O_CREAT | O_NOFOLLOW | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        debug_printf("Cache: Failed to create %s: %m\n", path);
+    }
+    else {
+        debug_printf("Cache: Recorded %s\n", path);
+        close(fd);
+    }
+}
+
+/**
+ * Determine whether the members of the cache directory dir were verified as
+ * it was populated.
+ */
+bool
+cache_dir_is_verified(const char *dir)
+{
+    char *path = path_join(dir, VERIFIED_FILENAME);
+    bool result = marker_exists(path);
+    free(path);
+
+    return result;
+}
+
+/**
+ * Record that the members of the cache directory being populated in tmpdir
+ * have been verified.
+ */
+void
+cache_dir_set_verified(const char *tmpdir)
+{
+    char *path = path_join(tmpdir, VERIFIED_FILENAME);
+    create_marker(path);
+    free(path);
+}
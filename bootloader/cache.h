@@ -0,0 +1,22 @@
+#ifndef BOOTLOADER_CACHE_H
+#define BOOTLOADER_CACHE_H
+
+#include <stdbool.h>
+#include "index.h"
+
+char *cache_get_dir(const char *digest);
+
+char *cache_get_store(void);
+
+bool cache_dir_valid(const char *dir, const struct archive_index *idx);
+
+char *cache_create_tmpdir(const char *dir);
+
+void cache_commit(const char *tmpdir, const char *dir,
+                  const struct archive_index *idx);
+
+bool cache_dir_is_verified(const char *dir);
+
+void cache_dir_set_verified(const char *tmpdir);
+
+#endif /* BOOTLOADER_CACHE_H */
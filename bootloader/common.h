@@ -4,6 +4,8 @@
 #include <stdint.h>
 
 #define ARCHIVE_SECTION         ".staticx.archive"
+#define CONFIG_SECTION          ".staticx.config"
+#define INDEX_SECTION           ".staticx.index"
 #define INTERP_FILENAME         ".staticx.interp"
 #define PROG_FILENAME           ".staticx.prog"
 
@@ -27,4 +29,27 @@ cptr_add(const void *p, size_t off)
     return ((const uint8_t *)p) + off;
 }
 
+static inline uint16_t
+read_le16(const uint8_t *buf)
+{
+    return (uint16_t)buf[0]
+        | ((uint16_t)buf[1] << 8);
+}
+
+static inline uint32_t
+read_le32(const uint8_t *buf)
+{
+    return (uint32_t)buf[0]
+        | ((uint32_t)buf[1] << 8)
+        | ((uint32_t)buf[2] << 16)
+        | ((uint32_t)buf[3] << 24);
+}
+
+static inline uint64_t
+read_le64(const uint8_t *buf)
+{
+    return (uint64_t)read_le32(buf)
+        | ((uint64_t)read_le32(buf + 4) << 32);
+}
+
 #endif /* BOOTLOADER_COMMON_H */
@@ -0,0 +1,136 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include "common.h"
+#include "config.h"
+#include "error.h"
+
+#define CONFIG_MAX_ITEMS    32
+#define ENV_PREFIX          "STATICX_"
+
+struct config_item
+{
+    const char *key;
+    const char *value;
+};
+
+/* Copy of the config section; items point into this */
+static char *m_config_data;
+static struct config_item m_items[CONFIG_MAX_ITEMS];
+static int m_num_items;
+
+static void
+parse_line(char *line)
+{
+    if (*line == '\0' || *line == '#')
+        return;
+
+    char *eq = strchr(line, '=');
+    if (!eq) {
+        debug_printf("Ignoring malformed config line: \"%s\"\n", line);
+        return;
+    }
+    *eq = '\0';
+
+    if (m_num_items == CONFIG_MAX_ITEMS)
+        error(2, 0, "Too many config items");
+
+    m_items[m_num_items++] = (struct config_item) {
+        .key    = line,
+        .value  = eq + 1,
+    };
+    debug_printf("Config: %s = \"%s\"\n", line, eq + 1);
+}
+
+void
+config_load(Elf_Ehdr *ehdr)
+{
+    /* Bundles built by older versions of staticx have no config */
+    const Elf_Shdr *shdr = elf_get_section_by_name(ehdr, CONFIG_SECTION);
+    if (!shdr) {
+        debug_printf("No "CONFIG_SECTION" section\n");
+        return;
+    }
+
+    /* Copy it, so we can NUL-terminate each key and value in place */
+    size_t size = shdr->sh_size;
+    m_config_data = malloc(size + 1);
+    if (!m_config_data)
+        error(2, 0, "Failed to allocate config");
+    memcpy(m_config_data, cptr_add(ehdr, shdr->sh_offset), size);
+    m_config_data[size] = '\0';
+
+    char *saveptr;
+    for (char *line = strtok_r(m_config_data, "\n", &saveptr);
+            line != NULL;
+            line = strtok_r(NULL, "\n", &saveptr))
+    {
+        parse_line(line);
+    }
+}
+
+static const char *
+env_get(const char *key)
+{
+    char name[64];
+    size_t prefix_len = strlen(ENV_PREFIX);
+
+    if (prefix_len + strlen(key) >= sizeof(name))
+        return NULL;
+
+    strcpy(name, ENV_PREFIX);
+    for (char *p = name + prefix_len; *key; key++, p++) {
+        *p = toupper((unsigned char)*key);
+        p[1] = '\0';
+    }
+
+    return getenv(name);
+}
+
+/**
+ * Get an option as stored by the builder, ignoring the environment. This is
+ * for options which describe how the bundle was built.
+ */
+const char *
+config_get_stored(const char *key)
+{
+    for (int i = 0; i < m_num_items; i++) {
+        if (strcmp(m_items[i].key, key) == 0)
+            return m_items[i].value;
+    }
+    return NULL;
+}
+
+const char *
+config_get(const char *key)
+{
+    /* The environment takes precedence over the bundle */
+    const char *value = env_get(key);
+    if (value)
+        return value;
+
+    return config_get_stored(key);
+}
+
+bool
+config_get_bool(const char *key, bool def)
+{
+    const char *value = config_get(key);
+    if (!value || *value == '\0')
+        return def;
+
+    if (strcmp(value, "1") == 0
+            || strcasecmp(value, "yes") == 0
+            || strcasecmp(value, "true") == 0)
+        return true;
+
+    if (strcmp(value, "0") == 0
+            || strcasecmp(value, "no") == 0
+            || strcasecmp(value, "false") == 0)
+        return false;
+
+    error(0, 0, "Ignoring invalid value for %s: \"%s\"", key, value);
+    return def;
+}
@@ -0,0 +1,20 @@
+#ifndef BOOTLOADER_CONFIG_H
+#define BOOTLOADER_CONFIG_H
+
+#include <stdbool.h>
+#include "elfutil.h"
+
+/**
+ * Options are stored by the builder in the CONFIG_SECTION as "key=value"
+ * lines. Any option can be overridden at runtime by setting the environment
+ * variable STATICX_<KEY> (e.g. STATICX_CACHE=0).
+ */
+void config_load(Elf_Ehdr *ehdr);
+
+const char *config_get(const char *key);
+
+const char *config_get_stored(const char *key);
+
+bool config_get_bool(const char *key, bool def);
+
+#endif /* BOOTLOADER_CONFIG_H */
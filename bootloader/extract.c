@@ -1,13 +1,25 @@
+#define _GNU_SOURCE
 #include <errno.h>
 #include <libtar.h>
 #include <fcntl.h>
+#include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
 #include "common.h"
+#include "config.h"
 #include "elfutil.h"
 #include "error.h"
 #include "extract.h"
-#include "mmap.h"
+#include "index.h"
+#include "memfd.h"
+#include "tarview.h"
+#include "uring.h"
+#include "util.h"
 #include "xz.h"
+#include "xzmt.h"
+#include "xzpipe.h"
+#include "xzstream.h"
 
 
 /**
@@ -22,8 +34,20 @@
 
 #define XZ_DICT_MAX     8<<20       /* 8 MiB */
 
+/* Largest archive (or member) to decode in one go, rather than streaming it
+ * through an XZ_DICT_MAX dictionary (see decode_whole()) */
+#define XZ_SINGLE_MAX   (256<<20)   /* 256 MiB */
+
+/* The extracted files only need to be usable by us: so don't look up (let
+ * alone restore) their owners or restore their mtimes, and give them their
+ * mode when creating them. */
+#define TAR_EXTRACT_OPTIONS (TAR_NOOWNER | TAR_NOMTIME | TAR_NOCHMOD)
+
 static struct xz_dec *m_xzdec = NULL;
 
+/* Set once the last stream has been decoded */
+static bool m_xzeof;
+
 /* This is used by both the xztype and memtype tar handlers */
 static struct xz_buf m_xzbuf;
 
@@ -50,6 +74,7 @@ static int xz_open(const char *pathname, int oflags, ...)
         error(2, 0, "Failed to initialize xz decoder");
         return -1;
     }
+    m_xzeof = false;
 
     return XZ_FAKE_FD;
 }
@@ -69,8 +94,33 @@ static int xz_close(int fd)
     return 0;
 }
 
+/**
+ * Prepare to decode the next stream, after XZ_STREAM_END.
+ *
+ * Returns false if there are no more streams.
+ */
+static bool xz_next_stream(void)
+{
+    /* Skip Stream Padding */
+    while (m_xzbuf.in_size - m_xzbuf.in_pos >= 4) {
+        static const uint8_t zeros[4];
+        if (memcmp(m_xzbuf.in + m_xzbuf.in_pos, zeros, 4) != 0)
+            break;
+        m_xzbuf.in_pos += 4;
+    }
+
+    if (m_xzbuf.in_pos == m_xzbuf.in_size)
+        return false;
+
+    xz_dec_reset(m_xzdec);
+    return true;
+}
+
 static ssize_t xz_read(int fd, void * const buf, size_t const len)
 {
+    if (m_xzeof)
+        return 0;
+
     /* Decompress into given output buffer */
     m_xzbuf.out      = buf;
     m_xzbuf.out_pos  = 0;
@@ -86,8 +136,13 @@ static ssize_t xz_read(int fd, void * const buf, size_t const len)
                 continue;
 
             case XZ_STREAM_END:
-                /* Return 0 to indicate EOF */
-                return 0;
+                /* The archive may consist of several concatenated streams */
+                if (xz_next_stream())
+                    continue;
+
+                /* Return what we have; 0 indicates EOF */
+                m_xzeof = true;
+                return m_xzbuf.out_pos;
 
             default:
                 error(2, 0, "xz_dec_run returned %s (%d)\n", xzret_to_str(xr), xr);
@@ -151,34 +206,717 @@ static ssize_t mem_read(int fd, void * const buf, size_t len)
     return len;
 }
 
+/**
+ * Let libtar write file contents straight from the mapped archive, rather
+ * than copying it one block at a time.
+ */
+static const void *mem_map(int fd, size_t len)
+{
+    if (fd != XZ_FAKE_FD) {
+        debug_printf("Unexpected fd %d\n", fd);
+        return NULL;
+    }
+
+    if (len > m_xzbuf.in_size - m_xzbuf.in_pos)
+        return NULL;
+
+    const void *data = m_xzbuf.in + m_xzbuf.in_pos;
+    m_xzbuf.in_pos += len;
+
+    return data;
+}
+
 static tartype_t memtype = {
     .openfunc   = mem_open,
     .closefunc  = mem_close,
     .readfunc   = mem_read,
+    .mapfunc    = mem_map,
 };
 
 /*******************************************************************************/
 
-void
-extract_archive(const char *dest_path)
+/**
+ * Wraps another tartype_t, computing the CRC32 and size of the data read, so
+ * a member extracted on its own can be checked against the archive index.
+ */
+static struct
 {
-    /* mmap this ELF file */
-    struct map *map = mmap_file("/proc/self/exe", true);
+    tartype_t *base;
+    uint32_t crc32;
+    size_t size;
+} m_member;
 
-    /* Find the .staticx.archive section */
-    Elf_Ehdr *ehdr = map->map;
-    if (!elf_is_valid(ehdr))
-        error(2, 0, "Invalid ELF header");
+static int member_open(const char *pathname, int oflags, ...)
+{
+    m_member.crc32 = 0;
+    m_member.size = 0;
+    return m_member.base->openfunc(pathname, oflags);
+}
+
+static int member_close(int fd)
+{
+    return m_member.base->closefunc(fd);
+}
+
+static ssize_t member_read(int fd, void * const buf, size_t len)
+{
+    ssize_t n = m_member.base->readfunc(fd, buf, len);
+    if (n > 0) {
+        m_member.crc32 = xz_crc32(buf, n, m_member.crc32);
+        m_member.size += n;
+    }
+    return n;
+}
+
+static const void *member_map(int fd, size_t len)
+{
+    if (!m_member.base->mapfunc)
+        return NULL;
+
+    const void *data = m_member.base->mapfunc(fd, len);
+    if (data) {
+        m_member.crc32 = xz_crc32(data, len, m_member.crc32);
+        m_member.size += len;
+    }
+    return data;
+}
+
+static tartype_t membertype = {
+    .openfunc   = member_open,
+    .closefunc  = member_close,
+    .readfunc   = member_read,
+    .mapfunc    = member_map,
+};
+
+/*******************************************************************************/
+
+/**
+ * Number of threads to use for decompression: the "threads" option, or by
+ * default, one per available CPU.
+ */
+static int
+decode_threads(void)
+{
+    const char *value = config_get("threads");
+    if (value) {
+        int n = atoi(value);
+        if (n > 0)
+            return n;
+    }
+    return available_cpus();
+}
+
+/* How regular files are written when extracting */
+struct write_options
+{
+    bool blocks;        /* One tar block at a time, as libtar originally did */
+    size_t size;        /* Otherwise, bytes per write() */
+    bool fallocate;     /* Preallocate files larger than size */
+};
+
+/**
+ * Get the write options:
+ *
+ *   write_strategy:    "buffered" (default) writes file data write_size bytes
+ *                      at a time; "blocks" writes it one tar block at a time.
+ *   write_size:        Bytes per write() with "buffered" (default 1 MiB).
+ *   fallocate:         Preallocate files larger than write_size (default on).
+ */
+static void
+get_write_options(struct write_options *wo)
+{
+    *wo = (struct write_options) {
+        .blocks     = false,
+        .size       = T_CHUNKSIZE,
+        .fallocate  = config_get_bool("fallocate", true),
+    };
+
+    const char *strategy = config_get("write_strategy");
+    if (strategy && strcmp(strategy, "blocks") == 0)
+        wo->blocks = true;
+    else if (strategy && strcmp(strategy, "buffered") != 0)
+        error(2, 0, "Invalid write strategy: %s", strategy);
+
+    const char *size = config_get("write_size");
+    if (size) {
+        wo->size = strtoul(size, NULL, 0) / T_BLOCKSIZE * T_BLOCKSIZE;
+        if (wo->size == 0)
+            error(2, 0, "Invalid write size: %s", size);
+    }
+
+    if (wo->blocks)
+        debug_printf("Writing files a block at a time\n");
+    else
+        debug_printf("Writing files %zu bytes at a time%s\n", wo->size,
+                wo->fallocate ? ", preallocated" : "");
+}
+
+/**
+ * Set up how libtar writes regular files.
+ */
+static void
+configure_writes(TAR *t, const struct write_options *wo)
+{
+    if (wo->blocks) {
+        t->options |= TAR_WRITE_BLOCKS;
+        return;
+    }
+
+    if (tar_set_chunksize(t, wo->size) != 0)
+        error(2, errno, "tar_set_chunksize() failed");
+    if (wo->fallocate)
+        t->options |= TAR_PREALLOCATE;
+}
+
+/**
+ * Write a regular file straight from the (in-memory) archive. It is created
+ * with its mode, which is only set again if the umask took some of it away.
+ */
+static int
+write_file_at(int dirfd, const struct tarview_entry *ent,
+        const struct write_options *wo)
+{
+    int fd = openat(dirfd, ent->name, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+            ent->mode);
+    if (fd < 0)
+        return -1;
+
+    if ((ent->mode & get_umask()) && fchmod(fd, ent->mode) < 0)
+        goto fail;
+
+    if (wo->fallocate && ent->size > wo->size) {
+        if (fallocate(fd, 0, 0, ent->size) < 0)
+            debug_printf("fallocate(%s) failed: %m\n", ent->name);
+    }
+
+    const char *p = ent->data;
+    size_t remain = ent->size;
+    while (remain > 0) {
+        ssize_t n = write(fd, p, (remain > wo->size) ? wo->size : remain);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            goto fail;
+        }
+        p += n;
+        remain -= n;
+    }
+
+    if (close(fd) < 0)
+        return -1;
+    return 0;
+
+fail:;
+    int saved_errno = errno;
+    close(fd);
+    errno = saved_errno;
+    return -1;
+}
+
+/**
+ * Extract one member read by tarview, with the same results as libtar's
+ * tar_extract_file_at() with TAR_EXTRACT_OPTIONS. Only the types of member
+ * written by the builder are supported.
+ */
+static int
+extract_entry_at(int dirfd, struct tarview_entry *ent,
+        const struct write_options *wo)
+{
+    /* Always relative to dirfd */
+    while (ent->name[0] == '/')
+        ent->name++;
+
+    debug_printf("Extracting %s (type %c, mode %04o, %zu bytes)\n",
+            ent->name, ent->type, ent->mode, ent->size);
+
+    switch (ent->type) {
+        case REGTYPE:
+        case CONTTYPE:
+            return write_file_at(dirfd, ent, wo);
+
+        case SYMTYPE:
+            return symlinkat(ent->linkname, dirfd, ent->name);
+
+        case LNKTYPE:
+            return linkat(dirfd, ent->linkname, dirfd, ent->name, 0);
+
+        case DIRTYPE:
+            if (mkdirat(dirfd, ent->name, ent->mode) < 0 && errno != EEXIST)
+                return -1;
+            return 0;
+
+        default:
+            errno = EINVAL;
+            return -1;
+    }
+}
+
+/*******************************************************************************/
+
+/**
+ * Extraction with io_uring
+ *
+ * Rather than making several system calls for each member (openat(),
+ * fallocate(), write()s and close()), the operations for a batch of members
+ * are queued in an io_uring and submitted together. The operations for a
+ * regular file are linked, and use a direct descriptor: the openat() puts
+ * the file in the member's slot of the ring's file table, which the writes
+ * then use, and which the close frees.
+ *
+ * The names are copied, but the contents are written straight from the
+ * archive, which must stay in memory until the batch is complete. A member
+ * whose operations failed is extracted again synchronously, which also
+ * produces the error message if it fails again.
+ */
+
+#define URING_ENTRIES   256
+#define URING_MEMBERS   64      /* Per batch; also the number of file slots */
+
+/* user_data of each operation: the member's index, and the opcode */
+#define URING_DATA(i, op)   (((uint64_t)(i) << 8) | (op))
+
+struct uring_member
+{
+    struct tarview_entry ent;   /* With our own copies of the names */
+    int res;                    /* First error, or 0 */
+};
+
+static struct
+{
+    struct uring ring;
+    struct uring_member members[URING_MEMBERS];
+    size_t nmembers;
+    unsigned inflight;          /* Operations queued but not completed */
+} m_uring;
+
+/**
+ * Set up the ring, if enabled by the "io_uring" option.
+ *
+ * Returns false if the synchronous system calls must be used.
+ */
+static bool
+uring_extract_init(void)
+{
+    static const uint8_t ops[] = {
+        IORING_OP_OPENAT,
+        IORING_OP_FALLOCATE,
+        IORING_OP_WRITE,
+        IORING_OP_CLOSE,
+        IORING_OP_SYMLINKAT,    /* Also implies direct descriptor support */
+    };
+
+    if (!config_get_bool("io_uring", false))
+        return false;
+
+    if (!uring_init(&m_uring.ring, URING_ENTRIES, URING_MEMBERS, ops, sizeof(ops))) {
+        debug_printf("Not using io_uring\n");
+        return false;
+    }
+
+    m_uring.nmembers = 0;
+    m_uring.inflight = 0;
+    return true;
+}
+
+/**
+ * Number of operations needed to extract ent, or 0 if it must be extracted
+ * synchronously: hard links and directories, because later members may
+ * depend on them, and files whose mode the umask would change.
+ */
+static unsigned
+uring_member_ops(const struct tarview_entry *ent, const struct write_options *wo)
+{
+    switch (ent->type) {
+        case REGTYPE:
+        case CONTTYPE:;
+            if (ent->mode & get_umask())
+                return 0;
+            size_t nops = 2 + (ent->size + wo->size - 1) / wo->size;
+            if (wo->fallocate && ent->size > wo->size)
+                nops++;
+            return (nops <= URING_ENTRIES) ? nops : 0;
+
+        case SYMTYPE:
+            return 1;
+
+        default:
+            return 0;
+    }
+}
+
+/* Whether there is room in the batch for a member needing nops operations */
+static bool
+uring_has_room(unsigned nops)
+{
+    return m_uring.nmembers < URING_MEMBERS
+        && nops <= uring_sq_space(&m_uring.ring);
+}
 
+static struct io_uring_sqe *
+uring_op(size_t i, uint8_t op, int fd, uint8_t flags)
+{
+    struct io_uring_sqe *sqe = uring_get_sqe(&m_uring.ring);
+    sqe->opcode = op;
+    sqe->fd = fd;
+    sqe->flags = flags;
+    sqe->user_data = URING_DATA(i, op);
+    m_uring.inflight++;
+    return sqe;
+}
+
+/**
+ * Queue the operations to extract ent, which uring_has_room() for.
+ */
+static void
+uring_queue(int dirfd, const struct tarview_entry *ent, const struct write_options *wo)
+{
+    size_t i = m_uring.nmembers++;
+    struct uring_member *m = &m_uring.members[i];
+    struct io_uring_sqe *sqe;
+
+    m->ent = *ent;
+    m->res = 0;
+    while (m->ent.name[0] == '/')
+        m->ent.name++;
+    m->ent.name = strdup(m->ent.name);
+    m->ent.linkname = strdup(m->ent.linkname);
+    if (!m->ent.name || !m->ent.linkname)
+        error(2, ENOMEM, "Failed to queue %s", ent->name);
+
+    debug_printf("Queueing %s (type %c, mode %04o, %zu bytes)\n",
+            m->ent.name, m->ent.type, m->ent.mode, m->ent.size);
+
+    if (m->ent.type == SYMTYPE) {
+        sqe = uring_op(i, IORING_OP_SYMLINKAT, dirfd, 0);
+        sqe->addr = (uintptr_t)m->ent.linkname;
+        sqe->addr2 = (uintptr_t)m->ent.name;
+        return;
+    }
+
+    /* Regular file, in slot i */
+    sqe = uring_op(i, IORING_OP_OPENAT, dirfd, IOSQE_IO_LINK);
+    sqe->addr = (uintptr_t)m->ent.name;
+    sqe->len = m->ent.mode;
+    sqe->open_flags = O_WRONLY | O_CREAT | O_TRUNC;     /* No O_CLOEXEC for direct */
+    sqe->file_index = i + 1;
+
+    if (wo->fallocate && m->ent.size > wo->size) {
+        /* Failure doesn't matter, so don't break the chain */
+        sqe = uring_op(i, IORING_OP_FALLOCATE, i, IOSQE_FIXED_FILE | IOSQE_IO_HARDLINK);
+        sqe->addr = m->ent.size;
+    }
+
+    for (size_t off = 0; off < m->ent.size; off += wo->size) {
+        size_t len = m->ent.size - off;
+        if (len > wo->size)
+            len = wo->size;
+
+        sqe = uring_op(i, IORING_OP_WRITE, i, IOSQE_FIXED_FILE | IOSQE_IO_LINK);
+        sqe->addr = (uintptr_t)cptr_add(m->ent.data, off);
+        sqe->len = len;
+        sqe->off = off;
+    }
+
+    /* Linked, so it runs after the writes. A failed write cancels it too;
+     * uring_drain() then closes the slot. */
+    sqe = uring_op(i, IORING_OP_CLOSE, 0, 0);
+    sqe->file_index = i + 1;
+}
+
+/* Submit the queued operations, without waiting for them */
+static void
+uring_submit_queued(void)
+{
+    if (uring_submit(&m_uring.ring, 0) < 0)
+        error(2, errno, "io_uring_enter() failed");
+}
+
+/* Wait for all queued operations, recording the first error of each member */
+static void
+uring_wait_all(void)
+{
+    while (m_uring.inflight > 0) {
+        if (uring_submit(&m_uring.ring, m_uring.inflight) < 0)
+            error(2, errno, "io_uring_enter() failed");
+
+        struct io_uring_cqe *cqe;
+        while ((cqe = uring_peek_cqe(&m_uring.ring))) {
+            struct uring_member *m = &m_uring.members[cqe->user_data >> 8];
+            uint8_t op = cqe->user_data & 0xFF;
+
+            if (cqe->res < 0 && op != IORING_OP_FALLOCATE && m->res == 0)
+                m->res = cqe->res;
+
+            uring_cqe_seen(&m_uring.ring);
+            m_uring.inflight--;
+        }
+    }
+}
+
+/**
+ * Complete the batch: wait for all queued operations, and extract any member
+ * whose operations failed again, synchronously.
+ */
+static void
+uring_drain(int dirfd, const char *dest_path, const struct write_options *wo)
+{
+    uring_wait_all();
+
+    /* A failed file's close was cancelled along with the rest of its chain.
+     * Close its slot now (which just fails if the openat() failed). */
+    bool closing = false;
+    for (size_t i = 0; i < m_uring.nmembers; i++) {
+        if (m_uring.members[i].res != 0 && m_uring.members[i].ent.type != SYMTYPE) {
+            struct io_uring_sqe *sqe = uring_op(i, IORING_OP_CLOSE, 0, 0);
+            sqe->file_index = i + 1;
+            closing = true;
+        }
+    }
+    if (closing)
+        uring_wait_all();
+
+    for (size_t i = 0; i < m_uring.nmembers; i++) {
+        struct uring_member *m = &m_uring.members[i];
+        if (m->res != 0) {
+            debug_printf("io_uring failed to extract %s: %s\n", m->ent.name, strerror(-m->res));
+            if (extract_entry_at(dirfd, &m->ent, wo) != 0)
+                error(2, errno, "Failed to extract %s to %s", m->ent.name, dest_path);
+        }
+        free((char *)m->ent.name);
+        free((char *)m->ent.linkname);
+    }
+    m_uring.nmembers = 0;
+}
+
+/* tarview wait function: submit what is queued, if it would have to wait for
+ * more to be decoded */
+static size_t
+uring_xzpipe_wait(size_t need)
+{
+    if (m_uring.ring.sq_pending && xzpipe_decoded() < need)
+        uring_submit_queued();
+    return xzpipe_wait(need);
+}
+
+/*******************************************************************************/
+
+/**
+ * Extract an uncompressed archive in place: the headers are parsed where they
+ * are, and file contents are written straight from the archive, without going
+ * through libtar. Where possible, this is done in batches with io_uring.
+ *
+ * If piped, the archive is still being decoded by xzpipe: each member is
+ * extracted once it has been decoded, and then released.
+ *
+ * Not for the "blocks" write strategy, which exists to compare against
+ * libtar's original behavior.
+ *
+ * Returns false if tarview can't read the archive, in which case it should be
+ * extracted with libtar instead (overwriting any members extracted so far).
+ */
+static bool
+extract_in_place(const void *data, size_t size, const char *dest_path,
+        const struct write_options *wo, bool piped)
+{
+    int dirfd = open(dest_path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dirfd < 0)
+        error(2, errno, "Failed to open %s", dest_path);
+
+    bool uring = uring_extract_init();
+
+    struct tarview tv;
+    struct tarview_entry ent;
+    int rc;
+
+    tarview_init(&tv, data, piped ? 0 : size);
+    if (piped)
+        tv.wait = uring ? uring_xzpipe_wait : xzpipe_wait;
+
+    /* End of the last member handed off (not necessarily written yet) */
+    size_t pos = 0;
+
+    while ((rc = tarview_next(&tv, &ent)) == 1) {
+        unsigned nops = uring ? uring_member_ops(&ent, wo) : 0;
+
+        if (nops) {
+            if (!uring_has_room(nops)) {
+                uring_drain(dirfd, dest_path, wo);
+                if (piped)
+                    xzpipe_release(pos);
+            }
+            uring_queue(dirfd, &ent, wo);
+        }
+        else {
+            if (uring)
+                uring_drain(dirfd, dest_path, wo);
+            if (extract_entry_at(dirfd, &ent, wo) != 0)
+                error(2, errno, "Failed to extract %s to %s", ent.name, dest_path);
+        }
+
+        pos = tv.pos;
+        if (piped && m_uring.nmembers == 0)
+            xzpipe_release(pos);
+    }
+    int saved_errno = errno;
+
+    if (uring) {
+        uring_drain(dirfd, dest_path, wo);
+        uring_exit(&m_uring.ring);
+    }
+
+    close(dirfd);
+
+    if (rc < 0) {
+        errno = saved_errno;
+        debug_printf("Failed to read archive in place: %m\n");
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Extract all (remaining) members of the archive into dest_path, using a
+ * directory fd rather than building a path for each member.
+ *
+ * Returns 0 on success, or -1 with errno set.
+ */
+static int
+extract_all_to(TAR *t, const char *dest_path)
+{
+    int dirfd = open(dest_path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dirfd < 0)
+        return -1;
+
+    int rc = tar_extract_all_at(t, dirfd);
+
+    int saved_errno = errno;
+    close(dirfd);
+    errno = saved_errno;
+
+    return rc;
+}
+
+/**
+ * Decode an .xz file whose uncompressed size is known from its Indexes, all
+ * at once, in single-call mode: the whole output is allocated once, and each
+ * stream is decoded straight into it, using it as the dictionary. The result
+ * is an uncompressed archive in memory, which can then be extracted in place.
+ *
+ * Returns the output (to be released with munmap()), or NULL if the streaming
+ * decoder must be used instead.
+ */
+static void *
+decode_whole(const void *data, size_t size, size_t *out_size)
+{
+    struct xz_stream_info *streams;
+    ssize_t n = xz_find_streams(data, size, &streams);
+    if (n <= 0)
+        return NULL;
+
+    size_t total = 0;
+    for (ssize_t i = 0; i < n; i++) {
+        if (streams[i].out_size > XZ_SINGLE_MAX - total) {
+            debug_printf("Too large to decode at once\n");
+            free(streams);
+            return NULL;
+        }
+        total += streams[i].out_size;
+    }
+
+    /* mmap() of zero bytes fails */
+    uint8_t *out = mmap(NULL, total ? total : 1, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (out == MAP_FAILED) {
+        debug_printf("Failed to allocate %zu bytes to decode into: %m\n", total);
+        free(streams);
+        return NULL;
+    }
+
+    size_t pos = 0;
+    for (ssize_t i = 0; i < n; i++) {
+        enum xz_ret xr = xz_decode_stream(data, &streams[i], out + pos);
+        if (xr != XZ_STREAM_END)
+            error(2, 0, "Failed to decode xz stream %zd: %s (%d)",
+                  i, xzret_to_str(xr), xr);
+        pos += streams[i].out_size;
+    }
+
+    free(streams);
+    *out_size = total;
+    return out;
+}
+
+static void
+free_decoded(void *data, size_t size)
+{
+    munmap(data, size ? size : 1);
+}
+
+static const void *
+get_archive(Elf_Ehdr *ehdr, size_t *size)
+{
+    /* Find the .staticx.archive section */
     const Elf_Shdr *shdr = elf_get_section_by_name(ehdr, ARCHIVE_SECTION);
     if (!shdr)
         error(2, 0, "Failed to find "ARCHIVE_SECTION" section");
 
-    size_t ar_size = shdr->sh_size;
-    const void *ar_data = cptr_add(ehdr, shdr->sh_offset);
+    *size = shdr->sh_size;
+    return cptr_add(ehdr, shdr->sh_offset);
+}
+
+void
+extract_archive(Elf_Ehdr *ehdr, const char *dest_path, unsigned int flags)
+{
+    size_t ar_size;
+    const void *ar_data = get_archive(ehdr, &ar_size);
+    bool compressed = is_xz_file(ar_data, ar_size);
+    bool memfd = (flags & EXTRACT_MEMFD) && memfd_supported();
+
+    struct write_options wo;
+    get_write_options(&wo);
+    bool in_place = !memfd && !wo.blocks;
+
+    /* Extract members as soon as they are decoded */
+    if (compressed && in_place && config_get_bool("pipeline", true)) {
+        size_t size;
+        void *out = xzpipe_start(ar_data, ar_size, XZ_SINGLE_MAX, decode_threads(), &size);
+        if (out) {
+            bool done = extract_in_place(out, size, dest_path, &wo, true);
+            xzpipe_finish();
+            if (done) {
+                debug_printf("Successfully extracted archive to %s\n", dest_path);
+                return;
+            }
+            /* The output is released as it is read; decode it again */
+            in_place = false;
+        }
+    }
+
+    /* Otherwise, determine how to decode it */
+    tartype_t *tartype = &memtype;
+    void *decoded = NULL;
+    size_t decoded_size = 0;
+    if (compressed) {
+        if (xzmt_setup(ar_data, ar_size, decode_threads()))
+            tartype = &xzmttype;
+        else if ((decoded = decode_whole(ar_data, ar_size, &decoded_size)))
+            compressed = false;
+        else
+            tartype = &xztype;
+    }
+    if (decoded) {
+        ar_data = decoded;
+        ar_size = decoded_size;
+    }
 
-    /* Determine if the archive is compressed */
-    tartype_t *tartype = is_xz_file(ar_data, ar_size) ? &xztype : &memtype;
+    /* An uncompressed archive is already in memory */
+    if (!compressed && in_place
+            && extract_in_place(ar_data, ar_size, dest_path, &wo, false)) {
+        if (decoded)
+            free_decoded(decoded, decoded_size);
+        debug_printf("Successfully extracted archive to %s\n", dest_path);
+        return;
+    }
 
     /* Input buffer; used by xztype and memtype handlers */
     m_xzbuf = (typeof(m_xzbuf)) {
@@ -191,18 +929,103 @@ extract_archive(const char *dest_path)
     /* Open the tar file */
     TAR *t;
     errno = 0;
-    if (tar_open(&t, "", tartype, O_RDONLY, 0, TAR_DEBUG_OPTIONS) != 0)
+    if (tar_open(&t, "", tartype, O_RDONLY, 0,
+                 TAR_EXTRACT_OPTIONS | TAR_DEBUG_OPTIONS) != 0)
         error(2, errno, "tar_open() failed");
+    configure_writes(t, &wo);
 
-    /* XXX Why is it so hard for people to use 'const'? */
-    if (tar_extract_all(t, (char*)dest_path) != 0)
-        error(2, errno, "tar_extract_all() failed");
+    if (memfd) {
+        if (memfd_extract_all(t, dest_path) != 0)
+            error(2, errno, "memfd_extract_all() failed");
+    }
+    else {
+        if (extract_all_to(t, dest_path) != 0)
+            error(2, errno, "Failed to extract archive to %s", dest_path);
+    }
 
     if (tar_close(t) != 0)
         error(2, errno, "tar_close() failed");
     t = NULL;
+    if (decoded)
+        free_decoded(decoded, decoded_size);
     debug_printf("Successfully extracted archive to %s\n", dest_path);
+}
+
+/**
+ * Extract a single member of the archive, located via the archive index,
+ * without decompressing any other member.
+ *
+ * Its CRC32 is checked against the index. (A compressed member is also
+ * checked by the xz decoder.)
+ */
+void
+extract_member(Elf_Ehdr *ehdr, const struct archive_member *m, const char *dest_path,
+               unsigned int flags)
+{
+    bool verify = true;
+
+    struct write_options wo;
+    get_write_options(&wo);
+
+    size_t ar_size;
+    const void *ar_data = get_archive(ehdr, &ar_size);
+
+    if (m->offset > ar_size || m->csize > ar_size - m->offset)
+        error(2, 0, "Archive member %s is out of bounds", m->name);
+
+    const void *data = cptr_add(ar_data, m->offset);
+    size_t size = m->csize;
+
+    /* Each member is compressed on its own */
+    bool compressed = is_xz_file(data, size);
+    void *decoded = NULL;
+    if (compressed && (decoded = decode_whole(data, size, &size))) {
+        data = decoded;
+        compressed = false;
+    }
+
+    if (!compressed) {
+        if (size != m->usize
+                || (verify && xz_crc32(data, size, 0) != m->crc32))
+            error(2, 0, "Archive member %s is corrupt", m->name);
+
+        if (!wo.blocks && extract_in_place(data, size, dest_path, &wo, false)) {
+            if (decoded)
+                free_decoded(decoded, size);
+            debug_printf("Extracted %s to %s\n", m->name, dest_path);
+            return;
+        }
+
+        /* Checked already */
+        verify = false;
+    }
+
+    m_member.base = compressed ? &xztype : &memtype;
+
+    m_xzbuf = (typeof(m_xzbuf)) {
+        .in      = data,
+        .in_pos  = 0,
+        .in_size = size,
+    };
+
+    TAR *t;
+    errno = 0;
+    if (tar_open(&t, "", verify ? &membertype : m_member.base, O_RDONLY, 0,
+                 TAR_EXTRACT_OPTIONS | TAR_DEBUG_OPTIONS) != 0)
+        error(2, errno, "tar_open() failed");
+    configure_writes(t, &wo);
+
+    if (extract_all_to(t, dest_path) != 0)
+        error(2, errno, "Failed to extract %s", m->name);
+
+    if (tar_close(t) != 0)
+        error(2, errno, "tar_close() failed");
+    t = NULL;
+    if (decoded)
+        free_decoded(decoded, size);
+
+    if (verify && (m_member.size != m->usize || m_member.crc32 != m->crc32))
+        error(2, 0, "Archive member %s is corrupt", m->name);
 
-    unmap_file(map);
-    map = NULL;
+    debug_printf("Extracted %s to %s\n", m->name, dest_path);
 }
@@ -1,6 +1,15 @@
 #ifndef BOOTLOADER_EXTRACT_H
 #define BOOTLOADER_EXTRACT_H
 
-void extract_archive(const char *dest_path);
+#include "elfutil.h"
+#include "index.h"
+
+/* Flags for extract_archive() and extract_member() */
+#define EXTRACT_MEMFD       0x1     /* Extract regular files to memfds */
+
+void extract_archive(Elf_Ehdr *ehdr, const char *dest_path, unsigned int flags);
+
+void extract_member(Elf_Ehdr *ehdr, const struct archive_member *m, const char *dest_path,
+                    unsigned int flags);
 
 #endif /* BOOTLOADER_EXTRACT_H */
@@ -0,0 +1,142 @@
+#include <stdlib.h>
+#include <string.h>
+#include "common.h"
+#include "error.h"
+#include "index.h"
+
+/**
+ * Archive index
+ *
+ * The builder stores each archive member as its own (compressed) unit, and
+ * records where each one is in the INDEX_SECTION, so that any member can be
+ * extracted without decompressing the others. All integers are little-endian:
+ *
+ *   Header:    magic "SXIX", u32 number of entries
+ *   Entry:     u64 offset, u64 csize, u64 usize, u32 crc32, u16 flags,
+ *              u16 name length, name (not NUL-terminated),
+ *              SHA-256 of the file's contents (only with MEMBER_DIGEST),
+ *              u64 size of the file (only with MEMBER_SIZE)
+ */
+
+#define INDEX_MAGIC         "SXIX"
+#define INDEX_MAGIC_SIZE    4
+#define INDEX_HEADER_SIZE   (INDEX_MAGIC_SIZE + 4)
+#define INDEX_ENTRY_SIZE    (8 + 8 + 8 + 4 + 2 + 2)
+#define INDEX_DIGEST_SIZE   32
+#define INDEX_SIZE_SIZE     8
+
+static char *
+hex_digest(const uint8_t *digest)
+{
+    static const char hex[] = "0123456789abcdef";
+
+    char *result = malloc(INDEX_DIGEST_SIZE * 2 + 1);
+    if (!result)
+        error(2, 0, "Failed to allocate archive index");
+
+    for (size_t i = 0; i < INDEX_DIGEST_SIZE; i++) {
+        result[i*2]     = hex[digest[i] >> 4];
+        result[i*2 + 1] = hex[digest[i] & 0xF];
+    }
+    result[INDEX_DIGEST_SIZE * 2] = '\0';
+    return result;
+}
+
+/**
+ * Load the archive index.
+ *
+ * Returns NULL if the bundle has no index (e.g. it was built by an older
+ * version of staticx).
+ */
+struct archive_index *
+archive_index_load(Elf_Ehdr *ehdr)
+{
+    const Elf_Shdr *shdr = elf_get_section_by_name(ehdr, INDEX_SECTION);
+    if (!shdr) {
+        debug_printf("No "INDEX_SECTION" section\n");
+        return NULL;
+    }
+
+    const uint8_t *data = cptr_add(ehdr, shdr->sh_offset);
+    size_t size = shdr->sh_size;
+
+    if (size < INDEX_HEADER_SIZE || memcmp(data, INDEX_MAGIC, INDEX_MAGIC_SIZE) != 0)
+        error(2, 0, "Invalid archive index");
+
+    struct archive_index *idx = malloc(sizeof(*idx));
+    if (!idx)
+        error(2, 0, "Failed to allocate archive index");
+
+    idx->count = read_le32(data + INDEX_MAGIC_SIZE);
+    idx->members = calloc(idx->count, sizeof(*idx->members));
+    if (idx->count && !idx->members)
+        error(2, 0, "Failed to allocate archive index");
+
+    size_t pos = INDEX_HEADER_SIZE;
+    for (size_t i = 0; i < idx->count; i++) {
+        struct archive_member *m = &idx->members[i];
+
+        if (size - pos < INDEX_ENTRY_SIZE)
+            error(2, 0, "Truncated archive index");
+
+        const uint8_t *ent = data + pos;
+        size_t namelen = read_le16(ent + 30);
+        pos += INDEX_ENTRY_SIZE;
+
+        if (size - pos < namelen)
+            error(2, 0, "Truncated archive index");
+
+        m->offset   = read_le64(ent);
+        m->csize    = read_le64(ent + 8);
+        m->usize    = read_le64(ent + 16);
+        m->crc32    = read_le32(ent + 24);
+        m->flags    = read_le16(ent + 28);
+        m->name     = strndup((const char *)data + pos, namelen);
+        if (!m->name)
+            error(2, 0, "Failed to allocate archive index");
+        pos += namelen;
+
+        if (m->flags & MEMBER_DIGEST) {
+            if (size - pos < INDEX_DIGEST_SIZE)
+                error(2, 0, "Truncated archive index");
+            m->digest = hex_digest(data + pos);
+            pos += INDEX_DIGEST_SIZE;
+        }
+
+        if (m->flags & MEMBER_SIZE) {
+            if (size - pos < INDEX_SIZE_SIZE)
+                error(2, 0, "Truncated archive index");
+            m->size = read_le64(data + pos);
+            pos += INDEX_SIZE_SIZE;
+        }
+
+        debug_printf("Index: %s offset=0x%zX csize=0x%zX usize=0x%zX flags=0x%X\n",
+                m->name, m->offset, m->csize, m->usize, m->flags);
+    }
+
+    return idx;
+}
+
+const struct archive_member *
+archive_index_find(const struct archive_index *idx, const char *name)
+{
+    for (size_t i = 0; i < idx->count; i++) {
+        if (strcmp(idx->members[i].name, name) == 0)
+            return &idx->members[i];
+    }
+    return NULL;
+}
+
+void
+archive_index_free(struct archive_index *idx)
+{
+    if (!idx)
+        return;
+
+    for (size_t i = 0; i < idx->count; i++) {
+        free(idx->members[i].name);
+        free(idx->members[i].digest);
+    }
+    free(idx->members);
+    free(idx);
+}
@@ -0,0 +1,38 @@
+#ifndef BOOTLOADER_INDEX_H
+#define BOOTLOADER_INDEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "elfutil.h"
+
+/* Location of one member in the archive */
+struct archive_member
+{
+    char *name;
+    size_t offset;      /* Offset of the (compressed) member in the archive */
+    size_t csize;       /* Size of the (compressed) member in the archive */
+    size_t usize;       /* Size of its tar data: header(s), contents, padding */
+    uint32_t crc32;     /* CRC32 of its tar data */
+    unsigned int flags; /* MEMBER_* */
+    char *digest;       /* Hex SHA-256 of the file it holds, or NULL */
+    size_t size;        /* Size of the file it holds (only with MEMBER_SIZE) */
+};
+
+/* Flags for archive_member */
+#define MEMBER_DIGEST       0x2     /* Has a digest */
+#define MEMBER_SIZE         0x4     /* Holds a regular file of known size */
+
+struct archive_index
+{
+    struct archive_member *members;
+    size_t count;
+};
+
+struct archive_index *archive_index_load(Elf_Ehdr *ehdr);
+
+const struct archive_member *
+archive_index_find(const struct archive_index *idx, const char *name);
+
+void archive_index_free(struct archive_index *idx);
+
+#endif /* BOOTLOADER_INDEX_H */
@@ -16,19 +16,33 @@
 #include "common.h"
 #include "extract.h"
 #include "elfutil.h"
+#include "cache.h"
+#include "config.h"
+#include "index.h"
+#include "memfd.h"
+#include "reaper.h"
+#include "store.h"
+#include "tmpdir.h"
+#include "tmpfs.h"
 
 
 /* Our "home" directory, where the archive is extracted */
 static const char *m_homedir;
 
-static char *
-path_join(const char *p1, const char *p2)
-{
-    char *result;
-    if (asprintf(&result, "%s/%s", p1, p2) < 0)
-        error(2, 0, "Failed to allocate path string");
-    return result;
-}
+/* Whether m_homedir is a persistent cache directory */
+static bool m_homedir_cached;
+
+/* Whether m_homedir is a private tmpfs */
+static bool m_homedir_tmpfs;
+
+/* Whether to launch the app by running the bundled ld.so */
+static bool m_ldso;
+
+/* Whether the builder left the program unpatched (implies m_ldso) */
+static bool m_prog_unpatched;
+
+/* Shared library store, if libraries are to be linked from it */
+static char *m_store;
 
 /******************************************************************************/
 
@@ -156,38 +170,191 @@ patch_prog_paths(const char *prog_path, const char *new_interp, const char *new_
     map = NULL;
 }
 
+/**
+ * Patch the user application extracted to extract_dir, so that it runs from
+ * homedir. These differ only when populating the cache.
+ */
 static void
-patch_app(const char *prog_path)
+patch_app(const char *extract_dir, const char *homedir)
 {
-    char *interp_path = path_join(m_homedir, INTERP_FILENAME);
-    const char *new_rpath = m_homedir;
+    if (m_prog_unpatched) {
+        debug_printf("Program is not patchable; will launch via ld.so\n");
+        return;
+    }
+
+    char *prog_path = path_join(extract_dir, PROG_FILENAME);
+    char *interp_path = path_join(homedir, INTERP_FILENAME);
+    const char *new_rpath = homedir;
 
     patch_prog_paths(prog_path, interp_path, new_rpath);
 
     free(interp_path);
+    free(prog_path);
+}
+
+/**
+ * Extract member m into dir: a library with a digest is linked from the
+ * shared store, if it is used.
+ */
+static void
+extract_one(Elf_Ehdr *ehdr, const struct archive_member *m, const char *dir,
+            unsigned int flags)
+{
+    if (m_store && m->digest && store_link_member(ehdr, m_store, m, dir, flags))
+        return;
+    extract_member(ehdr, m, dir, flags);
+}
+
+/**
+ * Extract the whole archive into dir. With the shared store, this is done
+ * member by member, so the libraries can be linked from it; by_member also
+ * forces that, so that each member is checked against the archive index.
+ */
+static void
+extract_all(Elf_Ehdr *ehdr, const char *dir, unsigned int flags, bool by_member)
+{
+    struct archive_index *idx = (m_store || by_member) ? archive_index_load(ehdr) : NULL;
+    if (!idx) {
+        extract_archive(ehdr, dir, flags);
+        return;
+    }
+
+    for (size_t i = 0; i < idx->count; i++)
+        extract_one(ehdr, &idx->members[i], dir, flags);
+
+    archive_index_free(idx);
 }
 
+/**
+ * Determine whether verify=once: members are checked against the archive
+ * index once, rather than on every run (verify=always, the default).
+ */
+static bool
+verify_once(void)
+{
+    const char *verify = config_get("verify");
+    if (!verify || strcmp(verify, "always") == 0)
+        return false;
+    if (strcmp(verify, "once") != 0)
+        error(2, 0, "Invalid verify option: %s", verify);
+    return true;
+}
+
+/**
+ * Set up a home directory in the extraction cache, extracting the archive
+ * into it if it is not already there.
+ *
+ * With verify=once, the cache is populated member by member, checking each
+ * against the archive index, and an entry so verified is then used without
+ * checking its members again.
+ *
+ * Returns NULL if the cache cannot be used.
+ */
 static char *
-create_tmpdir(void)
+setup_cached_home(Elf_Ehdr *ehdr)
 {
-    static char template[] = "/tmp/staticx-XXXXXX";
-    char *tmpdir = mkdtemp(template);
-    if (!tmpdir)
-        error(2, errno, "Failed to create tempdir");
-    return tmpdir;
+    const char *digest = config_get("digest");
+    if (!digest) {
+        debug_printf("Cache: No bundle digest\n");
+        return NULL;
+    }
+
+    char *dir = cache_get_dir(digest);
+    if (!dir)
+        return NULL;
+
+    bool once = verify_once();
+    struct archive_index *idx = archive_index_load(ehdr);
+
+    bool verified = once && cache_dir_is_verified(dir);
+    if (cache_dir_valid(dir, verified ? NULL : idx)) {
+        debug_printf("Cache: Using %s%s\n", dir, verified ? " (verified)" : "");
+        archive_index_free(idx);
+        return dir;
+    }
+
+    char *tmpdir = cache_create_tmpdir(dir);
+    if (!tmpdir) {
+        archive_index_free(idx);
+        free(dir);
+        return NULL;
+    }
+    debug_printf("Cache: Populating %s via %s\n", dir, tmpdir);
+
+    extract_all(ehdr, tmpdir, 0, once);
+    if (once && idx)
+        cache_dir_set_verified(tmpdir);
+    patch_app(tmpdir, dir);
+    cache_commit(tmpdir, dir, idx);
+
+    archive_index_free(idx);
+    free(tmpdir);
+    return dir;
+}
+
+/**
+ * Decide whether libraries are linked from the shared store.
+ */
+static void
+setup_store(void)
+{
+    if (!config_get_bool("share_libs", false))
+        return;
+
+    if (config_get_bool("memfd", false)) {
+        debug_printf("Shared store not used with memfd\n");
+        return;
+    }
+
+    m_store = cache_get_store();
+    if (!m_store)
+        debug_printf("Shared store unavailable\n");
+}
+
+static void
+setup_home(Elf_Ehdr *ehdr)
+{
+    setup_store();
+
+    if (config_get_bool("cache", false)) {
+        m_homedir = setup_cached_home(ehdr);
+        if (m_homedir) {
+            m_homedir_cached = true;
+            return;
+        }
+        debug_printf("Cache unavailable; extracting to temp dir\n");
+    }
+
+    /* Create temporary directory where archive will be extracted */
+    m_homedir = tmpdir_create(ehdr);
+    if (config_get_bool("tmpfs", false))
+        m_homedir_tmpfs = tmpfs_mount_private(m_homedir, config_get("tmpfs_huge"));
+
+    /* Extract the archive embedded in this program */
+    unsigned int flags = 0;
+    if (config_get_bool("memfd", false))
+        flags |= EXTRACT_MEMFD;
+    extract_all(ehdr, m_homedir, flags, false);
+
+    /* Patch the user application ELF to run in the temp dir; not needed
+     * when ld.so is told where to find everything. */
+    if (!m_ldso)
+        patch_app(m_homedir, m_homedir);
 }
 
 static char **
-make_argv(int orig_argc, char **orig_argv, char *argv0)
+make_argv(int orig_argc, char **orig_argv, char * const *prefix, int nprefix)
 {
     /**
      * Generate an argv to execute the user app:
      */
-    int len = 1 + (orig_argc-1) + 1;
+    int len = nprefix + (orig_argc-1) + 1;
     char **argv = calloc(len, sizeof(char*));
 
     int w = 0;
-    argv[w++] = argv0;
+    for (int i=0; i < nprefix; i++) {
+        argv[w++] = prefix[i];
+    }
 
     for (int i=1; i < orig_argc; i++) {
         argv[w++] = orig_argv[i];
@@ -198,6 +365,71 @@ make_argv(int orig_argc, char **orig_argv, char *argv0)
     return argv;
 }
 
+/**
+ * Generate the argv to execute the user app in m_homedir: either the app
+ * itself, or (when m_ldso) the bundled ld.so, told to run the app and look
+ * for libraries in m_homedir. Either way, the app gets its own path as argv[0].
+ */
+static char **
+make_app_argv(int orig_argc, char **orig_argv)
+{
+    char *prog_path = path_join(m_homedir, PROG_FILENAME);
+
+    if (!m_ldso)
+        return make_argv(orig_argc, orig_argv, &prog_path, 1);
+
+    /* --library-path replaces LD_LIBRARY_PATH, so search it after m_homedir */
+    char *library_path = (char *)m_homedir;
+    const char *user_path = getenv("LD_LIBRARY_PATH");
+    if (user_path && *user_path) {
+        if (asprintf(&library_path, "%s:%s", m_homedir, user_path) < 0)
+            error(2, 0, "Failed to allocate path string");
+    }
+
+    char *prefix[] = {
+        path_join(m_homedir, INTERP_FILENAME),
+        "--library-path",
+        library_path,
+        prog_path,
+    };
+    return make_argv(orig_argc, orig_argv, prefix, sizeof(prefix) / sizeof(prefix[0]));
+}
+
+/**
+ * Replace the bootloader with the user application, so it keeps our PID and
+ * there is no supervisor process.
+ */
+static void
+exec_app(char **new_argv)
+{
+    execv(new_argv[0], new_argv);
+
+    error(3, errno, "Failed to execv() %s", new_argv[0]);
+}
+
+/**
+ * Arrange for everything run_app() would do after the application exits to
+ * happen without us, so we can exec_app() instead.
+ *
+ * Returns false if that's not possible.
+ */
+static bool
+detach_cleanup(void)
+{
+    /* The cache stays; nothing to clean up */
+    if (m_homedir_cached)
+        return true;
+
+    pid_t pid = reaper_start(m_homedir, m_homedir_tmpfs);
+    if (pid < 0)
+        return false;
+
+    /* Our memfds are close-on-exec, so the application reaches them
+     * through the reaper's */
+    memfd_set_holder(pid);
+    return true;
+}
+
 static pid_t child_pid;
 
 static void sig_handler(int signum)
@@ -237,11 +469,8 @@ restore_sig_handler(int signum)
  * Returns the child wait status
  */
 static int
-run_app(int argc, char **argv, char *prog_path)
+run_app(char **new_argv)
 {
-    /* Generate argv for child app */
-    char **new_argv = make_argv(argc, argv, prog_path);
-
     debug_printf("New argv:\n");
     for (int i=0; ; i++) {
         char *a = new_argv[i];
@@ -294,30 +523,58 @@ int
 main(int argc, char **argv)
 {
     xz_crc32_init();
+    xz_crc64_init();
 
-    /* Create temporary directory where archive will be extracted */
-    m_homedir = create_tmpdir();
-    debug_printf("Home dir: %s\n", m_homedir);
+    /* mmap this ELF file */
+    struct map *map = mmap_file("/proc/self/exe", true);
 
-    /* Extract the archive embedded in this program */
-    extract_archive(m_homedir);
+    Elf_Ehdr *ehdr = map->map;
+    if (!elf_is_valid(ehdr))
+        error(2, 0, "Invalid ELF header");
 
-    /* Get path to user application inside temp dir */
-    char *prog_path = path_join(m_homedir, PROG_FILENAME);
+    /* Read the options stored by the builder */
+    config_load(ehdr);
 
-    /* Patch the user application ELF to run in the temp dir */
-    patch_app(prog_path);
+    /* Bundles built for ld.so launch hold the program unpatched, so it can
+     * only be enabled (not disabled) at runtime. */
+    const char *stored_ldso = config_get_stored("ldso");
+    m_prog_unpatched = stored_ldso && strcmp(stored_ldso, "1") == 0;
+    m_ldso = m_prog_unpatched || config_get_bool("ldso", false);
+
+    /* Extract the archive to our home directory */
+    setup_home(ehdr);
+    debug_printf("Home dir: %s\n", m_homedir);
+
+    /* Generate argv for the user application inside home dir */
+    char **new_argv = make_app_argv(argc, argv);
+
+    /* Become the user application, if we can clean up without waiting */
+    if (config_get_bool("exec", false)) {
+        if (detach_cleanup())
+            exec_app(new_argv);
+        debug_printf("Can't exec in place; running app in child process\n");
+    }
 
     /* Run the user application */
-    int wstatus = run_app(argc, argv, prog_path);
+    int wstatus = run_app(new_argv);
 
-    free(prog_path);
-    prog_path = NULL;
+    unmap_file(map);
+    map = NULL;
 
-    /* Cleanup */
-    debug_printf("Removing temp dir %s\n", m_homedir);
-    if (remove_tree(m_homedir) < 0) {
-        fprintf(stderr, "staticx: Failed to cleanup %s: %m\n", m_homedir);
+    /* Cleanup (the cache is left in place for the next run). A private
+     * tmpfs is simply discarded; otherwise, by default, this is done in the
+     * background so our exit status isn't delayed. */
+    if (m_homedir_tmpfs) {
+        debug_printf("Unmounting temp dir %s\n", m_homedir);
+        if (tmpfs_remove(m_homedir) < 0)
+            fprintf(stderr, "staticx: Failed to cleanup %s: %m\n", m_homedir);
+    }
+    else if (!m_homedir_cached && !(config_get_bool("async_cleanup", true)
+                && reaper_remove(m_homedir))) {
+        debug_printf("Removing temp dir %s\n", m_homedir);
+        if (remove_tree(m_homedir) < 0) {
+            fprintf(stderr, "staticx: Failed to cleanup %s: %m\n", m_homedir);
+        }
     }
     m_homedir = NULL;
 
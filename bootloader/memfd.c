@@ -0,0 +1,259 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include "common.h"
+#include "error.h"
+#include "memfd.h"
+#include "util.h"
+
+/**
+ * memfd extraction
+ *
+ * Instead of writing archive members to disk, each regular file is
+ * decompressed into an anonymous memory-backed file (memfd). The extraction
+ * directory then only holds symlinks to those files via /proc/<pid>/fd/N,
+ * so that the interpreter and libraries are found at the usual paths.
+ *
+ * The descriptors are close-on-exec: rather than relying on the user
+ * application (and whatever it runs) keeping them open, the symlinks point at
+ * the descriptors of a process which outlives it. That is the bootloader,
+ * while it waits for the application, or the reaper (see reaper.c) when the
+ * bootloader exec()s the application; see memfd_set_holder(). The memory is
+ * released once that process exits.
+ */
+
+/* See linux/memfd.h; older libcs don't define it */
+#ifndef MFD_CLOEXEC
+#define MFD_CLOEXEC     0x0001U
+#endif
+
+struct memfd_file
+{
+    char *path;
+    int fd;
+};
+
+/* Every file extracted to a memfd */
+static struct
+{
+    struct memfd_file *files;
+    size_t count;
+} m_memfd;
+
+static int
+memfd_create_compat(const char *name, unsigned int flags)
+{
+#ifdef SYS_memfd_create
+    /* Call it directly; older libcs don't have a wrapper */
+    return syscall(SYS_memfd_create, name, flags);
+#else
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+bool
+memfd_supported(void)
+{
+    int fd = memfd_create_compat("staticx-probe", 0);
+    if (fd < 0) {
+        debug_printf("memfd_create() not supported: %m\n");
+        return false;
+    }
+    close(fd);
+    return true;
+}
+
+/**
+ * Read the contents of the current regular file member into fd.
+ */
+static int
+memfd_read_contents(TAR *t, int fd)
+{
+    size_t size = th_get_size(t);
+    char block[T_BLOCKSIZE];
+    void *map;
+    int rc = -1;
+
+    if (ftruncate(fd, size) < 0)
+        return -1;
+
+    if (size == 0)
+        return 0;
+
+    map = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED)
+        return -1;
+
+    /* Copy it in one go, if the archive is already in memory */
+    const void *data = tar_data_map(t, T_PADDED_SIZE(size));
+    if (data) {
+        memcpy(map, data, size);
+        rc = 0;
+        goto out;
+    }
+
+    /* Read whole blocks directly into the file; no write() calls */
+    size_t whole = size - (size % T_BLOCKSIZE);
+    if (tar_data_read(t, map, whole) < 0)
+        goto out;
+
+    /* Final partial block goes through a bounce buffer */
+    if (whole < size) {
+        if (tar_data_read(t, block, T_BLOCKSIZE) < 0)
+            goto out;
+        memcpy(ptr_add(map, whole), block, size - whole);
+    }
+    rc = 0;
+
+out:
+    munmap(map, size);
+    return rc;
+}
+
+static void
+memfd_link_target(char *target, size_t size, pid_t pid, int fd)
+{
+    snprintf(target, size, "/proc/%d/fd/%d", (int)pid, fd);
+}
+
+static int
+memfd_add_file(const char *path, int fd)
+{
+    struct memfd_file *files = realloc(m_memfd.files,
+            (m_memfd.count + 1) * sizeof(*files));
+    if (!files)
+        return -1;
+    m_memfd.files = files;
+
+    char *p = strdup(path);
+    if (!p)
+        return -1;
+
+    m_memfd.files[m_memfd.count++] = (struct memfd_file){
+        .path   = p,
+        .fd     = fd,
+    };
+    return 0;
+}
+
+static int
+memfd_extract_regfile(TAR *t, const char *path)
+{
+    const char *name = th_get_pathname(t);
+    char target[48];
+    int fd, rofd;
+
+    fd = memfd_create_compat(name, MFD_CLOEXEC);
+    if (fd < 0)
+        return -1;
+
+    if (memfd_read_contents(t, fd) < 0) {
+        close(fd);
+        return -1;
+    }
+
+    /**
+     * Re-open it read-only, and close the writable descriptor: the kernel
+     * refuses to execute a file which is open for writing (ETXTBSY).
+     */
+    snprintf(target, sizeof(target), "/proc/self/fd/%d", fd);
+    rofd = open(target, O_RDONLY | O_CLOEXEC);
+    close(fd);
+    if (rofd < 0)
+        return -1;
+
+    memfd_link_target(target, sizeof(target), getpid(), rofd);
+    debug_printf("memfd: %s -> %s\n", path, target);
+
+    if (symlink(target, path) < 0 || memfd_add_file(path, rofd) < 0) {
+        close(rofd);
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Re-point the symlinks to the extracted files at process pid, which has
+ * the same descriptors (i.e. was forked after the extraction), and must stay
+ * around for as long as the files are needed.
+ */
+void
+memfd_set_holder(pid_t pid)
+{
+    char target[48];
+
+    for (size_t i = 0; i < m_memfd.count; i++) {
+        const struct memfd_file *f = &m_memfd.files[i];
+        char *tmp_path;
+
+        if (asprintf(&tmp_path, "%s.tmp", f->path) < 0)
+            error(2, 0, "Failed to allocate path string");
+
+        memfd_link_target(target, sizeof(target), pid, f->fd);
+        debug_printf("memfd: %s -> %s\n", f->path, target);
+
+        /* Replace the symlink atomically */
+        if (symlink(target, tmp_path) < 0 || rename(tmp_path, f->path) < 0)
+            error(2, errno, "Failed to re-point %s", f->path);
+
+        free(tmp_path);
+    }
+}
+
+/**
+ * Determine whether fd is one of the extracted files.
+ */
+bool
+memfd_is_extracted(int fd)
+{
+    for (size_t i = 0; i < m_memfd.count; i++) {
+        if (m_memfd.files[i].fd == fd)
+            return true;
+    }
+    return false;
+}
+
+/**
+ * Extract all members of the archive, using memfds for regular files.
+ *
+ * Returns 0 on success, or -1 with errno set (like tar_extract_all()).
+ */
+int
+memfd_extract_all(TAR *t, const char *prefix)
+{
+    int i;
+
+    while ((i = th_read(t)) == 0) {
+        char *path = path_join(prefix, th_get_pathname(t));
+        int rc;
+
+        if (t->options & TAR_VERBOSE)
+            th_print_long_ls(t);
+
+        if (TH_ISDIR(t))
+            rc = mkdir(path, 0700);
+        else if (TH_ISSYM(t))
+            rc = symlink(th_get_linkname(t), path);
+        else if (TH_ISREG(t))
+            rc = memfd_extract_regfile(t, path);
+        else {
+            errno = EINVAL;
+            rc = -1;
+        }
+
+        free(path);
+        if (rc != 0)
+            return -1;
+    }
+
+    return (i == 1 ? 0 : -1);
+}
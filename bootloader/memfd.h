@@ -0,0 +1,16 @@
+#ifndef BOOTLOADER_MEMFD_H
+#define BOOTLOADER_MEMFD_H
+
+#include <stdbool.h>
+#include <sys/types.h>
+#include <libtar.h>
+
+bool memfd_supported(void);
+
+int memfd_extract_all(TAR *t, const char *prefix);
+
+void memfd_set_holder(pid_t pid);
+
+bool memfd_is_extracted(int fd);
+
+#endif /* BOOTLOADER_MEMFD_H */
@@ -0,0 +1,240 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include "common.h"
+#include "error.h"
+#include "memfd.h"
+#include "reaper.h"
+#include "tmpfs.h"
+#include "util.h"
+
+/**
+ * Detached cleanup
+ *
+ * When the bootloader exec()s the user application directly, there is no
+ * parent process left to remove the extraction directory once it exits.
+ * Instead, a "reaper" process is started, detached from the application
+ * (double fork, new session, no stdio) so it is invisible to it and to
+ * whoever waits on it. The reaper holds a pidfd for the bootloader's process,
+ * which becomes readable when the process (by then, the application) exits.
+ *
+ * The reaper also holds any files extracted to memfds, for the application
+ * to reach through its /proc/<pid>/fd (see memfd.c).
+ *
+ * The same kind of process is used to remove the extraction directory after
+ * the application exits, so the bootloader can return its exit status
+ * without waiting for that.
+ */
+
+/* See linux/ioprio.h */
+#define IOPRIO_CLASS_IDLE       3
+#define IOPRIO_CLASS_SHIFT      13
+#define IOPRIO_WHO_PROCESS      1
+
+static int
+pidfd_open_compat(pid_t pid, unsigned int flags)
+{
+#ifdef SYS_pidfd_open
+    /* Call it directly; older libcs don't have a wrapper */
+    return syscall(SYS_pidfd_open, pid, flags);
+#else
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+/**
+ * Detach from the application's stdio and any other files it has open, so
+ * that e.g. a shell reading its output doesn't wait for the reaper too.
+ * keep_fd and the files extracted to memfds are left open.
+ */
+static void
+detach_files(int keep_fd)
+{
+    int fd = open("/dev/null", O_RDWR);
+    if (fd >= 0) {
+        dup2(fd, STDIN_FILENO);
+        dup2(fd, STDOUT_FILENO);
+        dup2(fd, STDERR_FILENO);
+        if (fd > STDERR_FILENO)
+            close(fd);
+    }
+
+    DIR *d = opendir("/proc/self/fd");
+    if (!d)
+        return;
+
+    struct dirent *ent;
+    while ((ent = readdir(d)) != NULL) {
+        int n = atoi(ent->d_name);
+        if (n > STDERR_FILENO && n != keep_fd && n != dirfd(d)
+                && !memfd_is_extracted(n))
+            close(n);
+    }
+    closedir(d);
+}
+
+/**
+ * Stay out of the way of the application (and anything else).
+ */
+static void
+lower_priority(void)
+{
+    if (setpriority(PRIO_PROCESS, 0, 19) < 0)
+        debug_printf("setpriority failed: %m\n");
+
+#ifdef SYS_ioprio_set
+    if (syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0,
+                IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT) < 0)
+        debug_printf("ioprio_set failed: %m\n");
+#endif
+}
+
+/**
+ * Fork a process which is detached from this one: not our child, in its own
+ * session, with no stdio, and in /. keep_fd is left open.
+ *
+ * Returns 0 in the detached process, and its pid in this process.
+ * Returns -1 if it could not be started.
+ */
+static pid_t
+fork_detached(int keep_fd)
+{
+    /* For the intermediate process to report the detached one's pid */
+    int pipefd[2];
+    if (pipe2(pipefd, O_CLOEXEC) < 0)
+        return -1;
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        close(pipefd[0]);
+        close(pipefd[1]);
+        return -1;
+    }
+
+    if (pid == 0) {
+        /*** Child ***/
+        setsid();
+
+        /* Fork again, so the detached process is not our child (nor the
+         * app's, after we exec it) */
+        pid = fork();
+        if (pid != 0)
+            _exit(pid < 0 || write(pipefd[1], &pid, sizeof(pid)) != sizeof(pid));
+
+        if (chdir("/") < 0)
+            debug_printf("detached: chdir failed: %m\n");
+        detach_files(keep_fd);
+        return 0;
+    }
+
+    /*** Parent ***/
+    close(pipefd[1]);
+
+    int wstatus;
+    while (waitpid(pid, &wstatus, 0) < 0) {
+        if (errno != EINTR)
+            error(2, errno, "Failed to wait for process %d", pid);
+    }
+
+    pid_t detached_pid;
+    bool ok = WIFEXITED(wstatus) && WEXITSTATUS(wstatus) == 0
+        && read(pipefd[0], &detached_pid, sizeof(detached_pid)) == sizeof(detached_pid);
+    close(pipefd[0]);
+
+    return ok ? detached_pid : -1;
+}
+
+static void
+wait_for_exit(int pidfd)
+{
+    struct pollfd pfd = {
+        .fd     = pidfd,
+        .events = POLLIN,
+    };
+
+    while (poll(&pfd, 1, -1) < 0) {
+        if (errno != EINTR)
+            break;
+    }
+}
+
+static void
+run_reaper(const char *dir, bool tmpfs, int pidfd)
+{
+    lower_priority();
+    wait_for_exit(pidfd);
+
+    if (tmpfs)
+        tmpfs_remove(dir);
+    else
+        remove_tree(dir);
+}
+
+/**
+ * Start a detached process which removes dir once this process exits,
+ * including after it exec()s another program. If tmpfs, dir is a private
+ * tmpfs (see tmpfs.c), which is unmounted rather than emptied.
+ *
+ * Returns the pid of the reaper process, or -1 if not supported by the
+ * kernel, in which case the caller must stay around to clean up.
+ */
+pid_t
+reaper_start(const char *dir, bool tmpfs)
+{
+    /* The pidfd is close-on-exec, so only the reaper keeps it */
+    int pidfd = pidfd_open_compat(getpid(), 0);
+    if (pidfd < 0) {
+        debug_printf("pidfd_open() not supported: %m\n");
+        return -1;
+    }
+
+    pid_t pid = fork_detached(pidfd);
+    if (pid == 0) {
+        run_reaper(dir, tmpfs, pidfd);
+        _exit(0);
+    }
+
+    close(pidfd);
+
+    if (pid < 0) {
+        debug_printf("Failed to start reaper process\n");
+        return -1;
+    }
+
+    debug_printf("Started reaper %d for %s\n", pid, dir);
+    return pid;
+}
+
+/**
+ * Remove dir in a detached, low-priority process, so the caller need not
+ * wait for it.
+ *
+ * Returns false if the process could not be started.
+ */
+bool
+reaper_remove(const char *dir)
+{
+    pid_t pid = fork_detached(-1);
+    if (pid == 0) {
+        lower_priority();
+        remove_tree(dir);
+        _exit(0);
+    }
+
+    if (pid < 0) {
+        debug_printf("Failed to start cleanup process\n");
+        return false;
+    }
+
+    debug_printf("Removing %s in the background\n", dir);
+    return true;
+}
@@ -0,0 +1,11 @@
+#ifndef BOOTLOADER_REAPER_H
+#define BOOTLOADER_REAPER_H
+
+#include <stdbool.h>
+#include <sys/types.h>
+
+pid_t reaper_start(const char *dir, bool tmpfs);
+
+bool reaper_remove(const char *dir);
+
+#endif /* BOOTLOADER_REAPER_H */
@@ -0,0 +1,122 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "common.h"
+#include "cache.h"
+#include "error.h"
+#include "extract.h"
+#include "store.h"
+#include "util.h"
+
+/**
+ * Shared library store
+ *
+ * Most bundles carry the same few libraries (libc, libstdc++, ...). Rather
+ * than every run of every bundle extracting its own copy, each of which then
+ * takes up the page cache again, a library can be extracted once into a store
+ * shared by all of a user's bundles, named after the SHA-256 of its contents
+ * recorded by the builder:
+ *
+ *      $XDG_CACHE_HOME/staticx/store/<sha256>
+ *
+ * Each run's directory just gets a symlink to it, so every process using the
+ * library maps the same file.
+ *
+ * Like cache entries, a library is extracted into a private temporary
+ * directory first, and renamed into place once complete, so any entry that
+ * exists is complete. Entries are made read-only, as they are shared, and
+ * are never removed. One which has been damaged since (e.g. truncated) no
+ * longer has the size recorded in the index, and is replaced.
+ */
+
+#define STORE_MODE  0555
+
+/**
+ * Determine whether path is a usable store entry for member m: a read-only
+ * regular file owned by us, of the member's size.
+ */
+static bool
+store_entry_valid(const char *path, const struct archive_member *m)
+{
+    struct stat st;
+
+    if (lstat(path, &st) < 0)
+        return false;
+
+    if (!S_ISREG(st.st_mode) || st.st_uid != geteuid()
+            || (st.st_mode & (S_IWUSR | S_IWGRP | S_IWOTH))) {
+        debug_printf("Store: %s is not usable\n", path);
+        return false;
+    }
+
+    if ((m->flags & MEMBER_SIZE) && (size_t)st.st_size != m->size) {
+        debug_printf("Store: %s has size %lld, not %zu\n", path,
+                (long long)st.st_size, m->size);
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * Extract member m into the store, as path.
+ *
+ * Returns false if it can't be added.
+ */
+static bool
+store_add(Elf_Ehdr *ehdr, const struct archive_member *m, const char *path,
+          unsigned int flags)
+{
+    char *tmpdir = cache_create_tmpdir(path);
+    if (!tmpdir)
+        return false;
+
+    extract_member(ehdr, m, tmpdir, flags);
+
+    /* Another instance may add it at the same time; either copy will do.
+     * This also replaces a damaged entry. */
+    char *src = path_join(tmpdir, m->name);
+    bool result = chmod(src, STORE_MODE) == 0 && rename(src, path) == 0;
+    if (result)
+        debug_printf("Store: Added %s as %s\n", m->name, path);
+    else
+        debug_printf("Store: Failed to add %s as %s: %m\n", m->name, path);
+    free(src);
+
+    if (remove_tree(tmpdir) < 0)
+        fprintf(stderr, "staticx: Failed to cleanup %s: %m\n", tmpdir);
+    free(tmpdir);
+
+    return result;
+}
+
+/**
+ * Put member m, which must have a digest, in dest_path as a symlink to its
+ * copy in the store at store_dir, extracting it there first if needed. flags
+ * are as for extract_member().
+ *
+ * Returns false if the store can't be used, in which case the member should
+ * be extracted as usual.
+ */
+bool
+store_link_member(Elf_Ehdr *ehdr, const char *store_dir,
+                  const struct archive_member *m, const char *dest_path,
+                  unsigned int flags)
+{
+    char *path = path_join(store_dir, m->digest);
+
+    bool result = store_entry_valid(path, m) || store_add(ehdr, m, path, flags);
+    if (result) {
+        char *link = path_join(dest_path, m->name);
+        if (symlink(path, link) < 0)
+            error(2, errno, "Failed to create symlink %s", link);
+        debug_printf("Store: Linked %s to %s\n", link, path);
+        free(link);
+    }
+
+    free(path);
+    return result;
+}
@@ -0,0 +1,12 @@
+#ifndef BOOTLOADER_STORE_H
+#define BOOTLOADER_STORE_H
+
+#include <stdbool.h>
+#include "elfutil.h"
+#include "index.h"
+
+bool store_link_member(Elf_Ehdr *ehdr, const char *store_dir,
+                       const struct archive_member *m, const char *dest_path,
+                       unsigned int flags);
+
+#endif /* BOOTLOADER_STORE_H */
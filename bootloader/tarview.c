@@ -0,0 +1,347 @@
+#include <errno.h>
+#include <stdbool.h>
+#include <string.h>
+#include <tar.h>
+#include "common.h"
+#include "tarview.h"
+
+/**
+ * In-place tar reader
+ *
+ * When the archive is stored uncompressed, it is already in memory (mapped
+ * from the bundle), so there is no need for libtar to copy each header into
+ * its own buffer, allocate GNU long names, and re-assemble the pathname every
+ * time it is asked for. Instead, the headers are parsed where they are, and
+ * each member is returned as pointers into the archive.
+ *
+ * Supports ustar and GNU (long name/link) headers, like libtar, and the path,
+ * linkpath and size records of pax extended headers, which Python's tarfile
+ * writes by default.
+ *
+ * The archive may also still be being written (decoded) while it is read:
+ * then only the first tv->size bytes are there yet, and tv->wait() is called
+ * to wait for more.
+ */
+
+#define BLOCKSIZE       512
+
+/* ustar header (all chars, so it can be used in place) */
+struct header
+{
+    char name[100];
+    char mode[8];
+    char uid[8];
+    char gid[8];
+    char size[12];
+    char mtime[12];
+    char chksum[8];
+    char typeflag;
+    char linkname[100];
+    char magic[6];
+    char version[2];
+    char uname[32];
+    char gname[32];
+    char devmajor[8];
+    char devminor[8];
+    char prefix[155];
+    char padding[12];
+};
+
+#define GNU_LONGNAME_TYPE       'L'
+#define GNU_LONGLINK_TYPE       'K'
+#define PAX_HEADER_TYPE         'x'
+#define PAX_GLOBAL_TYPE         'g'
+
+void
+tarview_init(struct tarview *tv, const void *buf, size_t size)
+{
+    tv->buf = buf;
+    tv->size = size;
+    tv->pos = 0;
+    tv->wait = NULL;
+}
+
+/* Whether len more bytes of the archive are there, waiting if need be */
+static bool
+available(struct tarview *tv, uint64_t len)
+{
+    if (len <= tv->size - tv->pos)
+        return true;
+    if (!tv->wait)
+        return false;
+
+    tv->size = tv->wait(tv->pos + len);
+    return len <= tv->size - tv->pos;
+}
+
+/**
+ * Parse a numeric field: octal, or GNU base-256 if the high bit is set.
+ */
+static uint64_t
+parse_number(const char *p, size_t len)
+{
+    const uint8_t *u = (const uint8_t *)p;
+    uint64_t val = 0;
+
+    if (u[0] & 0x80) {
+        val = u[0] & 0x7F;
+        for (size_t i = 1; i < len; i++)
+            val = (val << 8) | u[i];
+        return val;
+    }
+
+    size_t i = 0;
+    while (i < len && p[i] == ' ')
+        i++;
+    for (; i < len && p[i] >= '0' && p[i] <= '7'; i++)
+        val = (val << 3) | (p[i] - '0');
+    return val;
+}
+
+/**
+ * Sum the bytes of a header, 8 at a time: alternate bytes are added into
+ * four 16-bit lanes, which can't overflow (64 * 2 * 255 < 65536).
+ */
+static unsigned int
+header_sum(const uint8_t *hdr)
+{
+    const uint64_t mask = 0x00FF00FF00FF00FFull;
+    uint64_t lanes = 0;
+
+    for (size_t i = 0; i < BLOCKSIZE; i += 8) {
+        uint64_t w;
+        memcpy(&w, hdr + i, sizeof(w));
+        lanes += (w & mask) + ((w >> 8) & mask);
+    }
+
+    lanes = (lanes & 0x0000FFFF0000FFFFull) + ((lanes >> 16) & 0x0000FFFF0000FFFFull);
+    return (unsigned int)((lanes & 0xFFFFFFFF) + (lanes >> 32));
+}
+
+/* Old tar implementations summed signed chars (see th_signed_crc_calc()) */
+static int
+header_signed_sum(const uint8_t *hdr)
+{
+    int sum = 0;
+    for (size_t i = 0; i < BLOCKSIZE; i++)
+        sum += (signed char)hdr[i];
+    return sum;
+}
+
+static bool
+header_ok(const struct header *h)
+{
+    unsigned int want = parse_number(h->chksum, sizeof(h->chksum));
+
+    /* The checksum is calculated with the chksum field as spaces */
+    unsigned int field = 0;
+    int sfield = 0;
+    for (size_t i = 0; i < sizeof(h->chksum); i++) {
+        field += (uint8_t)h->chksum[i];
+        sfield += (signed char)h->chksum[i];
+    }
+
+    const int spaces = sizeof(h->chksum) * ' ';
+    if (header_sum((const uint8_t *)h) - field + spaces == want)
+        return true;
+    return header_signed_sum((const uint8_t *)h) - sfield + spaces == (int)want;
+}
+
+/**
+ * Get a NUL-terminated string from a field which is only terminated if it
+ * is shorter than the field: point to it if possible, or copy it into buf.
+ */
+static const char *
+field_str(const char *p, size_t len, char *buf, size_t bufsize)
+{
+    if (memchr(p, '\0', len))
+        return p;
+
+    if (len >= bufsize) {
+        errno = ENAMETOOLONG;
+        return NULL;
+    }
+    memcpy(buf, p, len);
+    buf[len] = '\0';
+    return buf;
+}
+
+/**
+ * Parse the records ("<length> <key>=<value>\n") of a pax extended header,
+ * keeping those which we need for the next member: path and linkpath (in
+ * tv->name and tv->linkname) and size.
+ *
+ * Returns 0, or -1 (with errno set) if the header is invalid.
+ */
+static int
+parse_pax(struct tarview *tv, const char *p, size_t len,
+          const char **path, const char **linkpath, uint64_t *size)
+{
+    while (len > 0 && p[0] != '\0') {
+        size_t reclen = 0, i = 0;
+        for (; i < len && p[i] >= '0' && p[i] <= '9' && reclen <= len; i++)
+            reclen = reclen * 10 + (p[i] - '0');
+        if (i == 0 || i >= len || p[i] != ' ' || reclen > len || reclen <= i + 1
+                || p[reclen - 1] != '\n')
+            goto invalid;
+
+        const char *key = p + i + 1;
+        const char *end = p + reclen - 1;
+        const char *eq = memchr(key, '=', end - key);
+        if (!eq)
+            goto invalid;
+
+        size_t klen = eq - key;
+        const char *val = eq + 1;
+        size_t vlen = end - val;
+
+        if (klen == 4 && memcmp(key, "path", 4) == 0) {
+            *path = field_str(val, vlen, tv->name, sizeof(tv->name));
+            if (!*path)
+                return -1;
+        }
+        else if (klen == 8 && memcmp(key, "linkpath", 8) == 0) {
+            *linkpath = field_str(val, vlen, tv->linkname, sizeof(tv->linkname));
+            if (!*linkpath)
+                return -1;
+        }
+        else if (klen == 4 && memcmp(key, "size", 4) == 0) {
+            *size = 0;
+            for (size_t j = 0; j < vlen; j++) {
+                if (val[j] < '0' || val[j] > '9' || *size > UINT64_MAX / 10)
+                    goto invalid;
+                *size = *size * 10 + (val[j] - '0');
+            }
+        }
+
+        p += reclen;
+        len -= reclen;
+    }
+    return 0;
+
+invalid:
+    errno = EINVAL;
+    return -1;
+}
+
+/* ustar: "prefix/name" */
+static const char *
+header_name(const struct header *h, char *buf, size_t bufsize)
+{
+    /* GNU tar uses the prefix field for other things */
+    if (memcmp(h->magic, TMAGIC, TMAGLEN) != 0 || h->prefix[0] == '\0')
+        return field_str(h->name, sizeof(h->name), buf, bufsize);
+
+    size_t plen = strnlen(h->prefix, sizeof(h->prefix));
+    size_t nlen = strnlen(h->name, sizeof(h->name));
+    if (plen + 1 + nlen >= bufsize) {
+        errno = ENAMETOOLONG;
+        return NULL;
+    }
+    memcpy(buf, h->prefix, plen);
+    buf[plen] = '/';
+    memcpy(buf + plen + 1, h->name, nlen);
+    buf[plen + 1 + nlen] = '\0';
+    return buf;
+}
+
+/**
+ * Read the next member of the archive into ent.
+ *
+ * Returns 1 if there is a member, 0 at the end of the archive, or -1 (with
+ * errno set) if the archive is invalid.
+ */
+int
+tarview_next(struct tarview *tv, struct tarview_entry *ent)
+{
+    const char *longname = NULL;
+    const char *longlink = NULL;
+    uint64_t pax_size = UINT64_MAX;     /* none */
+    int zero_blocks = 0;
+
+    for (;;) {
+        if (!available(tv, BLOCKSIZE)) {
+            if (tv->pos == tv->size)
+                return 0;
+            goto invalid;
+        }
+
+        const struct header *h = (const struct header *)(tv->buf + tv->pos);
+        tv->pos += BLOCKSIZE;
+
+        /* Two all-zero blocks mark the end */
+        if (h->name[0] == '\0') {
+            if (++zero_blocks >= 2)
+                return 0;
+            continue;
+        }
+
+        if (!header_ok(h))
+            goto invalid;
+
+        char type = h->typeflag;
+        uint64_t size = parse_number(h->size, sizeof(h->size));
+
+        /* A pax size applies to the member itself, not its other headers */
+        bool is_meta = type == GNU_LONGNAME_TYPE || type == GNU_LONGLINK_TYPE
+                || type == PAX_HEADER_TYPE || type == PAX_GLOBAL_TYPE;
+        if (!is_meta && pax_size != UINT64_MAX)
+            size = pax_size;
+
+        uint64_t padded = (size + BLOCKSIZE - 1) / BLOCKSIZE * BLOCKSIZE;
+        if (size > padded || !available(tv, padded))
+            goto invalid;
+
+        const char *data = (const char *)tv->buf + tv->pos;
+        tv->pos += padded;
+
+        switch (type) {
+            case GNU_LONGNAME_TYPE:
+                longname = field_str(data, size, tv->name, sizeof(tv->name));
+                if (!longname)
+                    return -1;
+                continue;
+
+            case GNU_LONGLINK_TYPE:
+                longlink = field_str(data, size, tv->linkname, sizeof(tv->linkname));
+                if (!longlink)
+                    return -1;
+                continue;
+
+            case PAX_HEADER_TYPE:
+                if (parse_pax(tv, data, size, &longname, &longlink, &pax_size) < 0)
+                    return -1;
+                continue;
+
+            case PAX_GLOBAL_TYPE:
+                /* Defaults for the rest of the archive; none that we use */
+                continue;
+        }
+
+        ent->name = longname;
+        if (!ent->name)
+            ent->name = header_name(h, tv->name, sizeof(tv->name));
+        ent->linkname = longlink;
+        if (!ent->linkname)
+            ent->linkname = field_str(h->linkname, sizeof(h->linkname),
+                    tv->linkname, sizeof(tv->linkname));
+        if (!ent->name || !ent->linkname)
+            return -1;
+
+        /* Old tars used "regular file" with a trailing slash for dirs */
+        if (type == AREGTYPE) {
+            size_t len = strlen(ent->name);
+            type = (len && ent->name[len - 1] == '/') ? DIRTYPE : REGTYPE;
+        }
+
+        ent->type = type;
+        ent->mode = parse_number(h->mode, sizeof(h->mode)) & 07777;
+        ent->size = size;
+        ent->data = data;
+        return 1;
+    }
+
+invalid:
+    errno = EINVAL;
+    return -1;
+}
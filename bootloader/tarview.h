@@ -0,0 +1,41 @@
+#ifndef BOOTLOADER_TARVIEW_H
+#define BOOTLOADER_TARVIEW_H
+
+#include <limits.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/* One member of the archive. The strings and data point into the archive
+ * (or the tarview) and are valid until the next call to tarview_next(). */
+struct tarview_entry
+{
+    const char *name;
+    const char *linkname;   /* "" if none */
+    char type;              /* Typeflag (REGTYPE, DIRTYPE, SYMTYPE, ...) */
+    mode_t mode;
+    size_t size;
+    const void *data;       /* Contents: size bytes */
+};
+
+/* Reader for a tar archive which is entirely in memory */
+struct tarview
+{
+    const uint8_t *buf;
+    size_t size;
+    size_t pos;
+
+    /* If set, called when the archive is shorter than needed, to wait until
+     * it is at least need bytes (or complete); returns its new size. */
+    size_t (*wait)(size_t need);
+
+    /* For names which are not NUL-terminated in the archive */
+    char name[PATH_MAX];
+    char linkname[PATH_MAX];
+};
+
+void tarview_init(struct tarview *tv, const void *buf, size_t size);
+
+int tarview_next(struct tarview *tv, struct tarview_entry *ent);
+
+#endif /* BOOTLOADER_TARVIEW_H */
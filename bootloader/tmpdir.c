@@ -0,0 +1,137 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <linux/magic.h>
+#include <sys/statfs.h>
+#include <sys/statvfs.h>
+#include "common.h"
+#include "config.h"
+#include "error.h"
+#include "index.h"
+#include "tmpdir.h"
+#include "util.h"
+
+/**
+ * Where the archive is extracted
+ *
+ * Each run extracts the archive into a new directory, "staticx-XXXXXX",
+ * under a root directory chosen by the "tmpdir" option:
+ *
+ *   (unset)    $TMPDIR, or /tmp if that isn't set
+ *   auto       The first of $TMPDIR (or /tmp), $XDG_RUNTIME_DIR and /dev/shm
+ *              which is a tmpfs we can use (see usable_tmpfs()), so the files
+ *              are never written to disk; otherwise, as if unset
+ *   /some/dir  That directory
+ */
+
+#define TMPDIR_TEMPLATE     "staticx-XXXXXX"
+
+static const char *
+default_root(void)
+{
+    const char *tmpdir = getenv("TMPDIR");
+    if (tmpdir && tmpdir[0] == '/')
+        return tmpdir;
+    return "/tmp";
+}
+
+/**
+ * Whether root is a tmpfs which we can extract to, and run programs from
+ * (many systems mount /dev/shm noexec), with need bytes free.
+ */
+static bool
+usable_tmpfs(const char *root, size_t need)
+{
+    struct statfs sfs;
+    struct statvfs svfs;
+
+    if (!root || root[0] != '/')
+        return false;
+
+    if (statfs(root, &sfs) < 0 || sfs.f_type != TMPFS_MAGIC) {
+        debug_printf("tmpdir: %s is not a tmpfs\n", root);
+        return false;
+    }
+
+    if (statvfs(root, &svfs) < 0 || (svfs.f_flag & (ST_NOEXEC | ST_RDONLY))) {
+        debug_printf("tmpdir: %s is noexec or read-only\n", root);
+        return false;
+    }
+
+    if (access(root, W_OK | X_OK) < 0) {
+        debug_printf("tmpdir: %s is not writable\n", root);
+        return false;
+    }
+
+    if ((uint64_t)svfs.f_bavail * svfs.f_frsize < need) {
+        debug_printf("tmpdir: %s has less than %zu bytes free\n", root, need);
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * The space the extracted files will take, according to the archive index,
+ * or 0 if unknown.
+ */
+static size_t
+extracted_size(Elf_Ehdr *ehdr)
+{
+    /* Only symlinks are written to the directory */
+    if (config_get_bool("memfd", false))
+        return 0;
+
+    struct archive_index *idx = archive_index_load(ehdr);
+    if (!idx)
+        return 0;
+
+    size_t size = 0;
+    for (size_t i = 0; i < idx->count; i++)
+        size += idx->members[i].usize;
+
+    archive_index_free(idx);
+    return size;
+}
+
+static const char *
+auto_root(size_t need)
+{
+    const char *candidates[] = {
+        default_root(),
+        getenv("XDG_RUNTIME_DIR"),
+        "/dev/shm",
+    };
+
+    for (size_t i = 0; i < sizeof(candidates) / sizeof(candidates[0]); i++) {
+        if (usable_tmpfs(candidates[i], need)) {
+            debug_printf("tmpdir: Using %s\n", candidates[i]);
+            return candidates[i];
+        }
+    }
+
+    return default_root();
+}
+
+/**
+ * Create the directory to extract the archive (of the bundle ehdr) into.
+ */
+char *
+tmpdir_create(Elf_Ehdr *ehdr)
+{
+    const char *root = config_get("tmpdir");
+    if (!root || root[0] == '\0')
+        root = default_root();
+    else if (strcmp(root, "auto") == 0)
+        root = auto_root(extracted_size(ehdr));
+    else if (root[0] != '/')
+        error(2, 0, "Invalid tmpdir (must be an absolute path, or \"auto\"): %s", root);
+
+    char *dir = path_join(root, TMPDIR_TEMPLATE);
+    if (!mkdtemp(dir))
+        error(2, errno, "Failed to create tempdir in %s", root);
+    return dir;
+}
@@ -0,0 +1,8 @@
+#ifndef BOOTLOADER_TMPDIR_H
+#define BOOTLOADER_TMPDIR_H
+
+#include "elfutil.h"
+
+char *tmpdir_create(Elf_Ehdr *ehdr);
+
+#endif /* BOOTLOADER_TMPDIR_H */
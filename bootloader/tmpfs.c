@@ -0,0 +1,141 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mount.h>
+#include "common.h"
+#include "error.h"
+#include "tmpfs.h"
+
+/**
+ * Private tmpfs
+ *
+ * Rather than writing the extracted files to disk, and removing them one by
+ * one afterwards, the bootloader can move into a new mount namespace, and
+ * mount a tmpfs over the (empty) temporary directory. The tmpfs is only
+ * visible to the bootloader and the processes it starts, and the kernel
+ * discards it, contents and all, when the last of them exits, even if they
+ * are killed. Only the empty mount point is left behind then.
+ *
+ * If we may create a mount namespace (e.g. as root), that is all we do, so
+ * the program keeps its privileges. Otherwise, we first move into a new user
+ * namespace, which maps our own user and group IDs (only), so the program
+ * still runs as the same user. Other IDs then appear as the overflow ID
+ * (nobody), and setuid programs it starts don't gain privileges.
+ */
+
+static int
+write_proc_file(const char *path, const char *fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+
+static int
+write_proc_file(const char *path, const char *fmt, ...)
+{
+    char buf[64];
+    va_list ap;
+
+    va_start(ap, fmt);
+    int len = vsnprintf(buf, sizeof(buf), fmt, ap);
+    va_end(ap);
+
+    int fd = open(path, O_WRONLY | O_CLOEXEC);
+    if (fd < 0)
+        return -1;
+
+    int rc = (write(fd, buf, len) == len) ? 0 : -1;
+    int saved_errno = errno;
+    close(fd);
+    errno = saved_errno;
+    return rc;
+}
+
+static void
+map_ids(uid_t uid, gid_t gid)
+{
+    /* Not allowed to fail after unshare(): there's no way back */
+    if (write_proc_file("/proc/self/setgroups", "deny") < 0)
+        error(2, errno, "Failed to write /proc/self/setgroups");
+    if (write_proc_file("/proc/self/uid_map", "%u %u 1\n", uid, uid) < 0)
+        error(2, errno, "Failed to write /proc/self/uid_map");
+    if (write_proc_file("/proc/self/gid_map", "%u %u 1\n", gid, gid) < 0)
+        error(2, errno, "Failed to write /proc/self/gid_map");
+}
+
+/**
+ * Move into a new mount namespace, and a new user namespace if we can't do
+ * that on our own.
+ *
+ * Returns false if neither is possible.
+ */
+static bool
+enter_namespaces(void)
+{
+    if (unshare(CLONE_NEWNS) == 0) {
+        /* Keep our mounts from propagating back to the parent namespace.
+         * (In a new user namespace, the kernel does this for us.) */
+        if (mount(NULL, "/", NULL, MS_REC | MS_SLAVE, NULL) < 0)
+            error(2, errno, "Failed to make mounts private");
+        debug_printf("Created mount namespace\n");
+        return true;
+    }
+    debug_printf("Failed to create mount namespace: %m\n");
+
+    uid_t uid = getuid();
+    gid_t gid = getgid();
+
+    if (unshare(CLONE_NEWUSER | CLONE_NEWNS) < 0) {
+        debug_printf("Failed to create namespaces: %m\n");
+        return false;
+    }
+    map_ids(uid, gid);
+    debug_printf("Created user and mount namespaces\n");
+    return true;
+}
+
+/**
+ * Mount a private tmpfs on the empty directory dir. huge, if not NULL, is the
+ * tmpfs "huge" option (e.g. "within_size"), which is ignored if the kernel
+ * doesn't support it.
+ *
+ * Returns false if that is not possible (e.g. unprivileged user namespaces
+ * are disabled), in which case dir is left as it is.
+ */
+bool
+tmpfs_mount_private(const char *dir, const char *huge)
+{
+    if (!enter_namespaces())
+        return false;
+
+    char opts[64];
+    if (huge) {
+        snprintf(opts, sizeof(opts), "mode=0700,huge=%s", huge);
+        if (mount("staticx", dir, "tmpfs", MS_NOSUID | MS_NODEV, opts) == 0)
+            goto mounted;
+        debug_printf("Failed to mount tmpfs with %s: %m\n", opts);
+    }
+
+    if (mount("staticx", dir, "tmpfs", MS_NOSUID | MS_NODEV, "mode=0700") < 0) {
+        debug_printf("Failed to mount tmpfs on %s: %m\n", dir);
+        return false;
+    }
+
+mounted:
+    debug_printf("Mounted private tmpfs on %s\n", dir);
+    return true;
+}
+
+/**
+ * Discard the private tmpfs mounted on dir, and remove the mount point.
+ */
+int
+tmpfs_remove(const char *dir)
+{
+    if (umount2(dir, MNT_DETACH) < 0)
+        return -1;
+    return rmdir(dir);
+}
@@ -0,0 +1,10 @@
+#ifndef BOOTLOADER_TMPFS_H
+#define BOOTLOADER_TMPFS_H
+
+#include <stdbool.h>
+
+bool tmpfs_mount_private(const char *dir, const char *huge);
+
+int tmpfs_remove(const char *dir);
+
+#endif /* BOOTLOADER_TMPFS_H */
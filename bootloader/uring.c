@@ -0,0 +1,240 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include "common.h"
+#include "uring.h"
+
+/**
+ * Minimal io_uring support
+ *
+ * Just enough to submit batches of operations and reap their completions,
+ * using the system calls directly (the bootloader is static, and doesn't
+ * link liburing). Without SQPOLL, the kernel only looks at the submission
+ * queue during io_uring_enter(), so only the ring indices shared with it need
+ * atomic accesses.
+ */
+
+static int
+io_uring_setup(unsigned entries, struct io_uring_params *p)
+{
+    return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int
+io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+    return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int
+io_uring_register(int fd, unsigned opcode, const void *arg, unsigned nr_args)
+{
+    return syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+/* Whether the kernel supports all of the given operations */
+static bool
+ops_supported(int fd, const uint8_t *ops, size_t nops)
+{
+    const unsigned nprobe = 256;
+    struct io_uring_probe *probe = calloc(1, sizeof(*probe)
+            + nprobe * sizeof(struct io_uring_probe_op));
+    if (!probe)
+        return false;
+
+    bool ok = io_uring_register(fd, IORING_REGISTER_PROBE, probe, nprobe) == 0;
+    for (size_t i = 0; ok && i < nops; i++) {
+        if (ops[i] > probe->last_op
+                || !(probe->ops[ops[i]].flags & IO_URING_OP_SUPPORTED)) {
+            debug_printf("io_uring operation %u not supported\n", ops[i]);
+            ok = false;
+        }
+    }
+
+    free(probe);
+    return ok;
+}
+
+/* Register a table of nfiles (initially empty) direct descriptors */
+static bool
+register_files(int fd, unsigned nfiles)
+{
+    int *fds = malloc(nfiles * sizeof(*fds));
+    if (!fds)
+        return false;
+    for (unsigned i = 0; i < nfiles; i++)
+        fds[i] = -1;
+
+    bool ok = io_uring_register(fd, IORING_REGISTER_FILES, fds, nfiles) == 0;
+    free(fds);
+    return ok;
+}
+
+/**
+ * Set up a ring of (at least) the given number of entries, with nfiles
+ * direct descriptors, which supports the nops operations ops.
+ *
+ * Returns false if io_uring can't be used (not supported by the kernel, or
+ * not allowed), in which case r must not be used.
+ */
+bool
+uring_init(struct uring *r, unsigned entries, unsigned nfiles,
+           const uint8_t *ops, size_t nops)
+{
+    struct io_uring_params p;
+
+    memset(r, 0, sizeof(*r));
+    memset(&p, 0, sizeof(p));
+
+    r->fd = io_uring_setup(entries, &p);
+    if (r->fd < 0) {
+        debug_printf("io_uring_setup() failed: %m\n");
+        return false;
+    }
+
+    r->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    r->cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (r->cq_ring_size > r->sq_ring_size)
+            r->sq_ring_size = r->cq_ring_size;
+        r->cq_ring_size = 0;
+    }
+
+    r->sq_ring = mmap(NULL, r->sq_ring_size, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+    if (r->sq_ring == MAP_FAILED)
+        goto fail;
+
+    r->cq_ring = r->sq_ring;
+    if (r->cq_ring_size) {
+        r->cq_ring = mmap(NULL, r->cq_ring_size, PROT_READ | PROT_WRITE,
+                          MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_CQ_RING);
+        if (r->cq_ring == MAP_FAILED)
+            goto fail;
+    }
+
+    r->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    r->sqes = mmap(NULL, r->sqes_size, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+    if (r->sqes == MAP_FAILED)
+        goto fail;
+
+    r->sq_head = ptr_add(r->sq_ring, p.sq_off.head);
+    r->sq_tail = ptr_add(r->sq_ring, p.sq_off.tail);
+    r->sq_mask = *(unsigned *)ptr_add(r->sq_ring, p.sq_off.ring_mask);
+    r->sq_entries = p.sq_entries;
+    r->sq_array = ptr_add(r->sq_ring, p.sq_off.array);
+    r->sq_tail_local = *r->sq_tail;
+
+    r->cq_head = ptr_add(r->cq_ring, p.cq_off.head);
+    r->cq_tail = ptr_add(r->cq_ring, p.cq_off.tail);
+    r->cq_mask = *(unsigned *)ptr_add(r->cq_ring, p.cq_off.ring_mask);
+    r->cqes = ptr_add(r->cq_ring, p.cq_off.cqes);
+
+    if (!ops_supported(r->fd, ops, nops))
+        goto fail;
+
+    if (nfiles && !register_files(r->fd, nfiles)) {
+        debug_printf("Failed to register io_uring files: %m\n");
+        goto fail;
+    }
+
+    return true;
+
+fail:
+    uring_exit(r);
+    return false;
+}
+
+void
+uring_exit(struct uring *r)
+{
+    if (r->sqes && r->sqes != MAP_FAILED)
+        munmap(r->sqes, r->sqes_size);
+    if (r->cq_ring_size && r->cq_ring && r->cq_ring != MAP_FAILED)
+        munmap(r->cq_ring, r->cq_ring_size);
+    if (r->sq_ring && r->sq_ring != MAP_FAILED)
+        munmap(r->sq_ring, r->sq_ring_size);
+    if (r->fd >= 0)
+        close(r->fd);
+
+    memset(r, 0, sizeof(*r));
+    r->fd = -1;
+}
+
+/* Number of SQEs which can still be prepared */
+unsigned
+uring_sq_space(const struct uring *r)
+{
+    unsigned head = __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE);
+    return r->sq_entries - (r->sq_tail_local - head);
+}
+
+/**
+ * Get the next (zeroed) SQE to prepare, or NULL if the submission queue is
+ * full. It is submitted by the next uring_submit().
+ */
+struct io_uring_sqe *
+uring_get_sqe(struct uring *r)
+{
+    if (uring_sq_space(r) == 0)
+        return NULL;
+
+    unsigned idx = r->sq_tail_local & r->sq_mask;
+    struct io_uring_sqe *sqe = &r->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    r->sq_array[idx] = idx;
+
+    r->sq_tail_local++;
+    r->sq_pending++;
+    return sqe;
+}
+
+/**
+ * Submit the prepared SQEs, and wait until at least wait_nr completions are
+ * available.
+ *
+ * Returns the number of SQEs submitted, or -1 with errno set.
+ */
+int
+uring_submit(struct uring *r, unsigned wait_nr)
+{
+    __atomic_store_n(r->sq_tail, r->sq_tail_local, __ATOMIC_RELEASE);
+
+    int total = 0;
+    for (;;) {
+        int n = io_uring_enter(r->fd, r->sq_pending, wait_nr,
+                               wait_nr ? IORING_ENTER_GETEVENTS : 0);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+
+        r->sq_pending -= n;
+        total += n;
+        if (r->sq_pending == 0)
+            return total;
+    }
+}
+
+/* The next completion, if there is one */
+struct io_uring_cqe *
+uring_peek_cqe(struct uring *r)
+{
+    unsigned head = *r->cq_head;
+    if (head == __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE))
+        return NULL;
+    return &r->cqes[head & r->cq_mask];
+}
+
+/* Mark the completion returned by uring_peek_cqe() as consumed */
+void
+uring_cqe_seen(struct uring *r)
+{
+    __atomic_store_n(r->cq_head, *r->cq_head + 1, __ATOMIC_RELEASE);
+}
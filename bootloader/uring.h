@@ -0,0 +1,52 @@
+#ifndef BOOTLOADER_URING_H
+#define BOOTLOADER_URING_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <linux/io_uring.h>
+
+/* A minimal io_uring, driven with the raw system calls */
+struct uring
+{
+    int fd;
+
+    /* Submission queue */
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned sq_mask;
+    unsigned sq_entries;
+    unsigned *sq_array;
+    struct io_uring_sqe *sqes;
+    unsigned sq_tail_local;     /* Tail including SQEs not yet submitted */
+    unsigned sq_pending;        /* SQEs prepared but not yet submitted */
+
+    /* Completion queue */
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned cq_mask;
+    struct io_uring_cqe *cqes;
+
+    void *sq_ring;
+    size_t sq_ring_size;
+    void *cq_ring;
+    size_t cq_ring_size;
+    size_t sqes_size;
+};
+
+bool uring_init(struct uring *r, unsigned entries, unsigned nfiles,
+                const uint8_t *ops, size_t nops);
+
+void uring_exit(struct uring *r);
+
+unsigned uring_sq_space(const struct uring *r);
+
+struct io_uring_sqe *uring_get_sqe(struct uring *r);
+
+int uring_submit(struct uring *r, unsigned wait_nr);
+
+struct io_uring_cqe *uring_peek_cqe(struct uring *r);
+
+void uring_cqe_seen(struct uring *r);
+
+#endif /* BOOTLOADER_URING_H */
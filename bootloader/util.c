@@ -1,14 +1,60 @@
-#define _XOPEN_SOURCE 500
+#define _GNU_SOURCE
 #include <stdlib.h>
 #include <stdio.h>          /* for remove(3) */
+#include <string.h>
 #include <unistd.h>
 #include <errno.h>
 #include <ftw.h>            /* file tree walk */
+#include <sched.h>
 #include <sys/stat.h>
+#include "error.h"
 #include "util.h"
 
 #define MAX_READLINK_ATTEMPT    10
 
+char *
+path_join(const char *p1, const char *p2)
+{
+    char *result;
+    if (asprintf(&result, "%s/%s", p1, p2) < 0)
+        error(2, 0, "Failed to allocate path string");
+    return result;
+}
+
+/**
+ * Create a directory and any missing parents (like mkdir -p).
+ * Returns 0 on success, or -1 with errno set.
+ */
+int
+mkdir_p(const char *path, mode_t mode)
+{
+    char *buf = strdup(path);
+    if (!buf) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    for (char *p = buf + 1; ; p++) {
+        if (*p != '/' && *p != '\0')
+            continue;
+
+        char c = *p;
+        *p = '\0';
+        if (mkdir(buf, mode) < 0 && errno != EEXIST) {
+            free(buf);
+            return -1;
+        }
+        *p = c;
+
+        if (c == '\0')
+            break;
+    }
+
+    free(buf);
+    errno = 0;
+    return 0;
+}
+
 char *
 readlinka(const char *path)
 {
@@ -85,3 +131,77 @@ remove_tree(const char *pathname)
     errno = 0;
     return nftw(pathname, remove_tree_fn, max_open_fd, flags);
 }
+
+
+/**
+ * Read a cgroup CPU bandwidth limit, as a (rounded up) number of CPUs.
+ * Returns 0 if there is no limit.
+ */
+static int
+cgroup_cpu_limit(void)
+{
+    long quota = -1, period = 0;
+    FILE *f;
+
+    /* cgroup v2: "$MAX $PERIOD", where $MAX may be "max" */
+    if ((f = fopen("/sys/fs/cgroup/cpu.max", "r")) != NULL) {
+        if (fscanf(f, "%ld %ld", &quota, &period) != 2)
+            quota = -1;
+        fclose(f);
+    }
+    /* cgroup v1 */
+    else if ((f = fopen("/sys/fs/cgroup/cpu/cpu.cfs_quota_us", "r")) != NULL) {
+        if (fscanf(f, "%ld", &quota) != 1)
+            quota = -1;
+        fclose(f);
+
+        if ((f = fopen("/sys/fs/cgroup/cpu/cpu.cfs_period_us", "r")) != NULL) {
+            if (fscanf(f, "%ld", &period) != 1)
+                period = 0;
+            fclose(f);
+        }
+    }
+
+    if (quota <= 0 || period <= 0)
+        return 0;
+
+    return (quota + period - 1) / period;
+}
+
+/**
+ * Determine the number of CPUs we can actually use, considering our
+ * affinity mask and any container CPU quota.
+ */
+int
+available_cpus(void)
+{
+    int ncpus;
+    cpu_set_t set;
+
+    if (sched_getaffinity(0, sizeof(set), &set) == 0)
+        ncpus = CPU_COUNT(&set);
+    else
+        ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+    int limit = cgroup_cpu_limit();
+    if (limit > 0 && limit < ncpus)
+        ncpus = limit;
+
+    return (ncpus > 0) ? ncpus : 1;
+}
+
+/**
+ * Get the process umask, without changing it (beyond the moment it takes to
+ * read it, so not while other threads are creating files).
+ */
+mode_t
+get_umask(void)
+{
+    static mode_t mask = (mode_t)-1;
+
+    if (mask == (mode_t)-1) {
+        mask = umask(0);
+        umask(mask);
+    }
+    return mask;
+}
@@ -1,8 +1,18 @@
 #ifndef UTIL_H
 #define UTIL_H
 
+#include <sys/types.h>
+
+char *path_join(const char *p1, const char *p2);
+
+int mkdir_p(const char *path, mode_t mode);
+
 char *readlinka(const char *path);
 
 int remove_tree(const char *pathname);
 
+int available_cpus(void);
+
+mode_t get_umask(void);
+
 #endif /* UTIL_H */
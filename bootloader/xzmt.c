@@ -0,0 +1,214 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include "common.h"
+#include "error.h"
+#include "xz.h"
+#include "xzmt.h"
+#include "xzstream.h"
+
+/**
+ * Multi-threaded xz decoding
+ *
+ * The builder splits the archive into several independent xz streams. Each
+ * worker thread takes the next stream and decodes it (in single-call mode)
+ * into its own buffer, while libtar consumes the decoded streams in order
+ * through the xzmttype read function.
+ *
+ * To bound memory usage, workers only run up to XZMT_WINDOW_PER_THREAD
+ * streams per thread ahead of the stream being consumed.
+ */
+
+#define XZMT_FAKE_FD            43
+#define XZMT_WINDOW_PER_THREAD  2
+
+struct xzmt_chunk
+{
+    uint8_t *buf;
+    enum xz_ret ret;
+    bool done;
+};
+
+static struct
+{
+    const uint8_t *in;
+    struct xz_stream_info *streams;
+    struct xzmt_chunk *chunks;
+    size_t nstreams;
+
+    pthread_t *threads;
+    int nthreads;
+    size_t window;
+
+    pthread_mutex_t lock;
+    pthread_cond_t cond;    /* signalled when a chunk is done or consumed */
+
+    size_t next;            /* next stream for a worker to decode */
+    size_t cur;             /* stream being consumed */
+    size_t cur_pos;         /* position in the current stream */
+    bool stop;
+} m_mt = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .cond = PTHREAD_COND_INITIALIZER,
+};
+
+static void *
+worker(void *arg)
+{
+    pthread_mutex_lock(&m_mt.lock);
+    for (;;) {
+        while (!m_mt.stop && m_mt.next < m_mt.nstreams
+                && m_mt.next >= m_mt.cur + m_mt.window)
+            pthread_cond_wait(&m_mt.cond, &m_mt.lock);
+
+        if (m_mt.stop || m_mt.next >= m_mt.nstreams)
+            break;
+
+        size_t i = m_mt.next++;
+        pthread_mutex_unlock(&m_mt.lock);
+
+        const struct xz_stream_info *si = &m_mt.streams[i];
+        struct xzmt_chunk *chunk = &m_mt.chunks[i];
+
+        /* malloc(0) may legitimately return NULL */
+        chunk->buf = malloc(si->out_size ? si->out_size : 1);
+        chunk->ret = chunk->buf ? xz_decode_stream(m_mt.in, si, chunk->buf) : XZ_MEM_ERROR;
+
+        pthread_mutex_lock(&m_mt.lock);
+        chunk->done = true;
+        pthread_cond_broadcast(&m_mt.cond);
+    }
+    pthread_mutex_unlock(&m_mt.lock);
+
+    return NULL;
+}
+
+/**
+ * Prepare to decode the archive with nthreads worker threads.
+ *
+ * Returns false if the archive can't benefit from it (e.g. it is a single
+ * stream), in which case the serial decoder should be used.
+ */
+bool
+xzmt_setup(const uint8_t *in, size_t in_size, int nthreads)
+{
+    ssize_t n = xz_find_streams(in, in_size, &m_mt.streams);
+    if (n < 2 || nthreads < 2) {
+        if (n > 0)
+            free(m_mt.streams);
+        m_mt.streams = NULL;
+        return false;
+    }
+
+    m_mt.in = in;
+    m_mt.nstreams = n;
+    m_mt.nthreads = (nthreads < n) ? nthreads : n;
+    m_mt.window = m_mt.nthreads * XZMT_WINDOW_PER_THREAD;
+
+    /* Left over from any previous archive decoded in this process */
+    m_mt.next = 0;
+    m_mt.cur = 0;
+    m_mt.cur_pos = 0;
+    m_mt.stop = false;
+
+    debug_printf("Decoding %zd xz streams with %d threads\n",
+            m_mt.nstreams, m_mt.nthreads);
+    return true;
+}
+
+static int
+xzmt_open(const char *pathname, int oflags, ...)
+{
+    m_mt.chunks = calloc(m_mt.nstreams, sizeof(*m_mt.chunks));
+    m_mt.threads = calloc(m_mt.nthreads, sizeof(*m_mt.threads));
+    if (!m_mt.chunks || !m_mt.threads)
+        error(2, 0, "Failed to allocate decoder state");
+
+    for (int i = 0; i < m_mt.nthreads; i++) {
+        int rc = pthread_create(&m_mt.threads[i], NULL, worker, NULL);
+        if (rc != 0)
+            error(2, rc, "Failed to create decoder thread");
+    }
+
+    return XZMT_FAKE_FD;
+}
+
+static int
+xzmt_close(int fd)
+{
+    if (fd != XZMT_FAKE_FD) {
+        debug_printf("Unexpected fd %d\n", fd);
+        return -1;
+    }
+
+    /* libtar may stop before consuming everything (at the end-of-archive
+     * marker), so tell any waiting workers to give up. */
+    pthread_mutex_lock(&m_mt.lock);
+    m_mt.stop = true;
+    pthread_cond_broadcast(&m_mt.cond);
+    pthread_mutex_unlock(&m_mt.lock);
+
+    for (int i = 0; i < m_mt.nthreads; i++)
+        pthread_join(m_mt.threads[i], NULL);
+
+    for (size_t i = 0; i < m_mt.nstreams; i++)
+        free(m_mt.chunks[i].buf);
+
+    free(m_mt.threads);
+    free(m_mt.chunks);
+    free(m_mt.streams);
+    m_mt.threads = NULL;
+    m_mt.chunks = NULL;
+    m_mt.streams = NULL;
+
+    return 0;
+}
+
+static ssize_t
+xzmt_read(int fd, void * const buf, size_t const len)
+{
+    size_t copied = 0;
+
+    while (copied < len && m_mt.cur < m_mt.nstreams) {
+        struct xzmt_chunk *chunk = &m_mt.chunks[m_mt.cur];
+        size_t size = m_mt.streams[m_mt.cur].out_size;
+
+        /* Wait for the current stream to be decoded */
+        pthread_mutex_lock(&m_mt.lock);
+        while (!chunk->done)
+            pthread_cond_wait(&m_mt.cond, &m_mt.lock);
+        pthread_mutex_unlock(&m_mt.lock);
+
+        if (chunk->ret != XZ_STREAM_END)
+            error(2, 0, "Failed to decode xz stream %zd (%d)", m_mt.cur, chunk->ret);
+
+        size_t n = size - m_mt.cur_pos;
+        if (n > len - copied)
+            n = len - copied;
+
+        memcpy(ptr_add(buf, copied), chunk->buf + m_mt.cur_pos, n);
+        copied += n;
+        m_mt.cur_pos += n;
+
+        /* Move on to the next stream, letting a worker start another */
+        if (m_mt.cur_pos == size) {
+            free(chunk->buf);
+            chunk->buf = NULL;
+
+            pthread_mutex_lock(&m_mt.lock);
+            m_mt.cur++;
+            m_mt.cur_pos = 0;
+            pthread_cond_broadcast(&m_mt.cond);
+            pthread_mutex_unlock(&m_mt.lock);
+        }
+    }
+
+    return copied;
+}
+
+tartype_t xzmttype = {
+    .openfunc   = xzmt_open,
+    .closefunc  = xzmt_close,
+    .readfunc   = xzmt_read,
+};
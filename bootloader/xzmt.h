@@ -0,0 +1,12 @@
+#ifndef BOOTLOADER_XZMT_H
+#define BOOTLOADER_XZMT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <libtar.h>
+
+bool xzmt_setup(const uint8_t *in, size_t in_size, int nthreads);
+
+extern tartype_t xzmttype;
+
+#endif /* BOOTLOADER_XZMT_H */
@@ -0,0 +1,339 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "common.h"
+#include "config.h"
+#include "error.h"
+#include "xz.h"
+#include "xzpipe.h"
+#include "xzstream.h"
+
+/**
+ * Pipelined decoding and extraction
+ *
+ * Decoder threads take the archive's xz streams in turn, and decode each one
+ * (in single-call mode) straight into its place in a buffer the size of the
+ * whole decoded archive. Meanwhile, the extracting thread writes files out of
+ * that buffer as soon as the part of it they occupy has been decoded, waiting
+ * in xzpipe_wait() when it catches up. So decoding and writing overlap, and
+ * extraction takes about as long as the slower of the two, not their sum.
+ *
+ * The extracting thread releases (with xzpipe_release()) what it has written,
+ * and the decoders only run up to XZPIPE_AHEAD bytes ahead of that, so only
+ * so much of the buffer is resident at once.
+ */
+
+#define XZPIPE_AHEAD    (32<<20)    /* 32 MiB */
+
+static struct
+{
+    const uint8_t *in;
+    struct xz_stream_info *streams;
+    size_t *offsets;        /* where each stream goes in out (nstreams + 1) */
+    bool *done;
+    size_t nstreams;
+
+    uint8_t *out;
+    size_t out_size;
+
+    pthread_t *threads;
+    int nthreads;
+
+    pthread_mutex_t lock;
+    pthread_cond_t cond;    /* signalled when a stream is done, or when the
+                               writer needs more or has released some */
+
+    size_t next;            /* next stream for a decoder */
+    size_t ndone;           /* streams decoded, in order */
+    size_t avail;           /* bytes of out decoded, in order */
+    size_t need;            /* bytes of out the writer is waiting for */
+    size_t released;        /* bytes of out the writer is done with */
+    bool stop;
+    enum xz_ret ret;        /* of the first stream which failed */
+    size_t failed;
+
+    /* Stage timings */
+    uint64_t start_ns;
+    uint64_t decode_ns;     /* decoding, summed over all decoders */
+    uint64_t stall_ns;      /* decoders waiting for the writer */
+    uint64_t wait_ns;       /* writer waiting for the decoders */
+} m_pipe = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .cond = PTHREAD_COND_INITIALIZER,
+};
+
+static uint64_t
+now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/**
+ * Whether a decoder may start on stream i: it is needed by the writer now,
+ * or it is not too far ahead of it.
+ */
+static bool
+may_start(size_t i)
+{
+    return m_pipe.offsets[i] < m_pipe.need
+        || m_pipe.offsets[i + 1] - m_pipe.released <= XZPIPE_AHEAD;
+}
+
+static void *
+decoder(void *arg)
+{
+    pthread_mutex_lock(&m_pipe.lock);
+    for (;;) {
+        uint64_t t = now_ns();
+        while (!m_pipe.stop && m_pipe.next < m_pipe.nstreams
+                && !may_start(m_pipe.next))
+            pthread_cond_wait(&m_pipe.cond, &m_pipe.lock);
+        m_pipe.stall_ns += now_ns() - t;
+
+        if (m_pipe.stop || m_pipe.next >= m_pipe.nstreams)
+            break;
+
+        size_t i = m_pipe.next++;
+        pthread_mutex_unlock(&m_pipe.lock);
+
+        t = now_ns();
+        enum xz_ret ret = xz_decode_stream(m_pipe.in, &m_pipe.streams[i],
+                m_pipe.out + m_pipe.offsets[i]);
+        t = now_ns() - t;
+
+        pthread_mutex_lock(&m_pipe.lock);
+        m_pipe.decode_ns += t;
+
+        if (ret != XZ_STREAM_END) {
+            /* Never let the writer have a stream which failed */
+            if (m_pipe.ret == XZ_STREAM_END) {
+                m_pipe.ret = ret;
+                m_pipe.failed = i;
+            }
+            m_pipe.stop = true;
+        }
+        else {
+            /* Let the writer have everything decoded in order so far */
+            m_pipe.done[i] = true;
+            while (m_pipe.ndone < m_pipe.nstreams && m_pipe.done[m_pipe.ndone])
+                m_pipe.ndone++;
+            m_pipe.avail = m_pipe.offsets[m_pipe.ndone];
+        }
+
+        pthread_cond_broadcast(&m_pipe.cond);
+    }
+    pthread_mutex_unlock(&m_pipe.lock);
+
+    return NULL;
+}
+
+/**
+ * Start decoding the .xz file in (of one or more streams) with nthreads
+ * decoder threads.
+ *
+ * Returns the buffer it is being decoded into, of *out_size bytes, which must
+ * only be read as far as xzpipe_wait() allows. Returns NULL if the streaming
+ * decoder should be used instead: the stream sizes can't be determined, or
+ * the decoded size would be larger than max_size.
+ */
+void *
+xzpipe_start(const uint8_t *in, size_t in_size, size_t max_size, int nthreads,
+             size_t *out_size)
+{
+    ssize_t n = xz_find_streams(in, in_size, &m_pipe.streams);
+    if (n <= 0)
+        return NULL;
+
+    m_pipe.offsets = calloc(n + 1, sizeof(*m_pipe.offsets));
+    m_pipe.done = calloc(n, sizeof(*m_pipe.done));
+    if (!m_pipe.offsets || !m_pipe.done)
+        error(2, 0, "Failed to allocate decoder state");
+
+    size_t total = 0;
+    for (ssize_t i = 0; i < n; i++) {
+        if (m_pipe.streams[i].out_size > max_size - total) {
+            debug_printf("Too large to decode at once\n");
+            goto fail;
+        }
+        total += m_pipe.streams[i].out_size;
+        m_pipe.offsets[i + 1] = total;
+    }
+
+    /* mmap() of zero bytes fails */
+    m_pipe.out = mmap(NULL, total ? total : 1, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (m_pipe.out == MAP_FAILED) {
+        debug_printf("Failed to allocate %zu bytes to decode into: %m\n", total);
+        goto fail;
+    }
+
+    m_pipe.in = in;
+    m_pipe.nstreams = n;
+    m_pipe.out_size = total;
+    m_pipe.nthreads = (nthreads < n) ? nthreads : n;
+
+    m_pipe.next = 0;
+    m_pipe.ndone = 0;
+    m_pipe.avail = 0;
+    m_pipe.need = 0;
+    m_pipe.released = 0;
+    m_pipe.stop = false;
+    m_pipe.ret = XZ_STREAM_END;
+
+    m_pipe.start_ns = now_ns();
+    m_pipe.decode_ns = 0;
+    m_pipe.stall_ns = 0;
+    m_pipe.wait_ns = 0;
+
+    m_pipe.threads = calloc(m_pipe.nthreads, sizeof(*m_pipe.threads));
+    if (!m_pipe.threads)
+        error(2, 0, "Failed to allocate decoder state");
+
+    for (int i = 0; i < m_pipe.nthreads; i++) {
+        int rc = pthread_create(&m_pipe.threads[i], NULL, decoder, NULL);
+        if (rc != 0)
+            error(2, rc, "Failed to create decoder thread");
+    }
+
+    debug_printf("Decoding %zd xz streams (%zu bytes) with %d threads, while extracting\n",
+            n, total, m_pipe.nthreads);
+    *out_size = total;
+    return m_pipe.out;
+
+fail:
+    free(m_pipe.streams);
+    free(m_pipe.offsets);
+    free(m_pipe.done);
+    m_pipe.streams = NULL;
+    m_pipe.offsets = NULL;
+    m_pipe.done = NULL;
+    m_pipe.out = NULL;
+    return NULL;
+}
+
+/* Exit if any stream failed to decode (called with the lock held) */
+static void
+check_failed(void)
+{
+    if (m_pipe.ret != XZ_STREAM_END) {
+        enum xz_ret ret = m_pipe.ret;
+        size_t failed = m_pipe.failed;
+        pthread_mutex_unlock(&m_pipe.lock);
+        error(2, 0, "Failed to decode xz stream %zu (%d)", failed, ret);
+    }
+}
+
+/**
+ * Wait until at least the first need bytes of the output have been decoded
+ * (or all of it, if need is beyond the end).
+ *
+ * Returns how much of the output has been decoded. Exits if any of the
+ * archive fails to decode.
+ */
+size_t
+xzpipe_wait(size_t need)
+{
+    if (need > m_pipe.out_size)
+        need = m_pipe.out_size;
+
+    pthread_mutex_lock(&m_pipe.lock);
+    if (m_pipe.avail < need) {
+        uint64_t t = now_ns();
+
+        /* Let the decoders know what to work on, even if it's far ahead */
+        m_pipe.need = need;
+        pthread_cond_broadcast(&m_pipe.cond);
+
+        while (m_pipe.avail < need && m_pipe.ret == XZ_STREAM_END)
+            pthread_cond_wait(&m_pipe.cond, &m_pipe.lock);
+        m_pipe.wait_ns += now_ns() - t;
+    }
+    check_failed();
+    size_t avail = m_pipe.avail;
+    pthread_mutex_unlock(&m_pipe.lock);
+
+    return avail;
+}
+
+/* How much of the output has been decoded so far, without waiting */
+size_t
+xzpipe_decoded(void)
+{
+    pthread_mutex_lock(&m_pipe.lock);
+    size_t avail = m_pipe.avail;
+    pthread_mutex_unlock(&m_pipe.lock);
+    return avail;
+}
+
+/**
+ * Tell the decoders that the first pos bytes of the output won't be read
+ * again. The memory they occupy is freed.
+ */
+void
+xzpipe_release(size_t pos)
+{
+    size_t page_size = sysconf(_SC_PAGESIZE);
+    size_t end = pos / page_size * page_size;
+    if (end <= m_pipe.released)
+        return;
+
+    if (madvise(m_pipe.out + m_pipe.released, end - m_pipe.released, MADV_DONTNEED) < 0)
+        debug_printf("madvise(MADV_DONTNEED) failed: %m\n");
+
+    pthread_mutex_lock(&m_pipe.lock);
+    m_pipe.released = end;
+    pthread_cond_broadcast(&m_pipe.cond);
+    pthread_mutex_unlock(&m_pipe.lock);
+}
+
+/**
+ * Stop decoding (the writer may stop at the end-of-archive marker, before the
+ * end of the output), and free the output.
+ *
+ * With the "timings" option, reports how long each stage took. Exits if any
+ * of the archive failed to decode.
+ */
+void
+xzpipe_finish(void)
+{
+    pthread_mutex_lock(&m_pipe.lock);
+    m_pipe.stop = true;
+    pthread_cond_broadcast(&m_pipe.cond);
+    pthread_mutex_unlock(&m_pipe.lock);
+
+    for (int i = 0; i < m_pipe.nthreads; i++)
+        pthread_join(m_pipe.threads[i], NULL);
+
+    pthread_mutex_lock(&m_pipe.lock);
+    check_failed();
+    pthread_mutex_unlock(&m_pipe.lock);
+
+    uint64_t total_ns = now_ns() - m_pipe.start_ns;
+    debug_printf("Extraction took %.1f ms\n", total_ns / 1e6);
+    if (config_get_bool("timings", false)) {
+        fprintf(stderr, "%s: extracted in %.1f ms: "
+                "decode %.1f ms (%d threads, waiting %.1f ms), "
+                "write %.1f ms (waiting %.1f ms)\n",
+                program_invocation_short_name, total_ns / 1e6,
+                m_pipe.decode_ns / 1e6, m_pipe.nthreads, m_pipe.stall_ns / 1e6,
+                (total_ns - m_pipe.wait_ns) / 1e6, m_pipe.wait_ns / 1e6);
+    }
+
+    munmap(m_pipe.out, m_pipe.out_size ? m_pipe.out_size : 1);
+    free(m_pipe.threads);
+    free(m_pipe.streams);
+    free(m_pipe.offsets);
+    free(m_pipe.done);
+    m_pipe.threads = NULL;
+    m_pipe.streams = NULL;
+    m_pipe.offsets = NULL;
+    m_pipe.done = NULL;
+    m_pipe.out = NULL;
+}
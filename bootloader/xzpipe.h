@@ -0,0 +1,18 @@
+#ifndef BOOTLOADER_XZPIPE_H
+#define BOOTLOADER_XZPIPE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+void *xzpipe_start(const uint8_t *in, size_t in_size, size_t max_size, int nthreads,
+                   size_t *out_size);
+
+size_t xzpipe_wait(size_t need);
+
+size_t xzpipe_decoded(void);
+
+void xzpipe_release(size_t pos);
+
+void xzpipe_finish(void);
+
+#endif /* BOOTLOADER_XZPIPE_H */
@@ -0,0 +1,215 @@
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "xz.h"
+#include "xz_stream.h"
+#include "common.h"
+#include "error.h"
+#include "xzstream.h"
+
+/**
+ * An .xz file is a sequence of one or more Streams (optionally separated by
+ * Stream Padding). Each Stream ends with an Index recording the compressed
+ * and uncompressed size of each of its Blocks, which is found via the
+ * Backward Size in the Stream Footer. By walking backwards from the end of
+ * the file we can locate every Stream without decompressing anything.
+ *
+ * See https://tukaani.org/xz/xz-file-format.txt
+ */
+
+#define STREAM_FLAGS_SIZE   2
+#define CRC32_SIZE          4
+
+/**
+ * Decode a Variable-length Integer.
+ *
+ * Returns the number of bytes consumed, or 0 if it is invalid.
+ */
+static size_t
+read_vli(const uint8_t *buf, size_t size, uint64_t *value)
+{
+    *value = 0;
+
+    for (size_t i = 0; i < size && i < VLI_BYTES_MAX; i++) {
+        *value |= (uint64_t)(buf[i] & 0x7F) << (i * 7);
+
+        if ((buf[i] & 0x80) == 0) {
+            /* Non-minimal encodings are not allowed */
+            if (i > 0 && buf[i] == 0)
+                return 0;
+            return i + 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Locate the Stream whose Stream Footer ends at offset 'end'.
+ */
+static bool
+find_stream_backward(const uint8_t *in, size_t end, struct xz_stream_info *info)
+{
+    if (end < 2 * STREAM_HEADER_SIZE)
+        return false;
+
+    /* Stream Footer: CRC32, Backward Size, Stream Flags, Footer Magic */
+    const uint8_t *footer = in + end - STREAM_HEADER_SIZE;
+
+    if (memcmp(footer + 10, FOOTER_MAGIC, FOOTER_MAGIC_SIZE) != 0)
+        return false;
+
+    if (xz_crc32(footer + 4, 4 + STREAM_FLAGS_SIZE, 0) != read_le32(footer))
+        return false;
+
+    size_t index_size = ((size_t)read_le32(footer + 4) + 1) * 4;
+    if (index_size > end - 2 * STREAM_HEADER_SIZE)
+        return false;
+
+    /* Index: Indicator, Number of Records, Records, Padding, CRC32 */
+    size_t index_start = end - STREAM_HEADER_SIZE - index_size;
+    const uint8_t *index = in + index_start;
+    size_t limit = index_size - CRC32_SIZE;
+
+    if (xz_crc32(index, limit, 0) != read_le32(index + limit))
+        return false;
+
+    if (index[0] != 0x00)
+        return false;
+
+    size_t pos = 1;
+    size_t n;
+    uint64_t num_records;
+
+    if ((n = read_vli(index + pos, limit - pos, &num_records)) == 0)
+        return false;
+    pos += n;
+
+    uint64_t blocks_size = 0;
+    uint64_t out_size = 0;
+
+    for (uint64_t i = 0; i < num_records; i++) {
+        uint64_t unpadded_size, uncompressed_size;
+
+        if ((n = read_vli(index + pos, limit - pos, &unpadded_size)) == 0)
+            return false;
+        pos += n;
+
+        if ((n = read_vli(index + pos, limit - pos, &uncompressed_size)) == 0)
+            return false;
+        pos += n;
+
+        /* Blocks are padded to a multiple of four bytes */
+        blocks_size += (unpadded_size + 3) & ~(uint64_t)3;
+        out_size += uncompressed_size;
+
+        if (blocks_size > index_start)
+            return false;
+    }
+
+    if (blocks_size + STREAM_HEADER_SIZE > index_start)
+        return false;
+
+    /* Stream Header: Header Magic, Stream Flags, CRC32 */
+    size_t start = index_start - blocks_size - STREAM_HEADER_SIZE;
+    const uint8_t *header = in + start;
+
+    if (memcmp(header, HEADER_MAGIC, HEADER_MAGIC_SIZE) != 0)
+        return false;
+
+    /* The Stream Flags in the Header and Footer must match */
+    if (memcmp(header + HEADER_MAGIC_SIZE, footer + 8, STREAM_FLAGS_SIZE) != 0)
+        return false;
+
+    *info = (struct xz_stream_info) {
+        .in_offset  = start,
+        .in_size    = end - start,
+        .out_size   = out_size,
+    };
+    return true;
+}
+
+/**
+ * Locate all of the Streams in an .xz file.
+ *
+ * On success, returns the number of streams, and sets *streams to a
+ * newly-allocated array (in file order) which the caller must free().
+ * Returns -1 if the input is not a valid .xz file.
+ */
+ssize_t
+xz_find_streams(const uint8_t *in, size_t in_size,
+        struct xz_stream_info **streams)
+{
+    struct xz_stream_info *result = NULL;
+    size_t count = 0;
+    size_t alloc = 0;
+    size_t end = in_size;
+
+    while (end > 0) {
+        /* Skip Stream Padding (null bytes, in multiples of four) */
+        while (end >= 4 && read_le32(in + end - 4) == 0)
+            end -= 4;
+        if (end == 0)
+            break;
+
+        if (count == alloc) {
+            alloc = alloc ? 2 * alloc : 16;
+            result = realloc(result, alloc * sizeof(*result));
+            if (!result)
+                error(2, 0, "Failed to allocate stream info");
+        }
+
+        if (!find_stream_backward(in, end, &result[count])) {
+            debug_printf("Invalid xz stream ending at offset 0x%zX\n", end);
+            free(result);
+            return -1;
+        }
+        end = result[count++].in_offset;
+    }
+
+    if (count == 0) {
+        free(result);
+        return -1;
+    }
+
+    /* Found last-to-first; put them in file order */
+    for (size_t i = 0; i < count / 2; i++) {
+        struct xz_stream_info tmp = result[i];
+        result[i] = result[count - 1 - i];
+        result[count - 1 - i] = tmp;
+    }
+
+    debug_printf("Found %zd xz stream(s)\n", count);
+    *streams = result;
+    return count;
+}
+
+/**
+ * Decode one Stream located by xz_find_streams(), in single-call mode,
+ * straight into out (which must hold info->out_size bytes). The output
+ * buffer doubles as the dictionary, so nothing else needs to be allocated
+ * for it, and the data isn't copied out of a separate one.
+ *
+ * Returns XZ_STREAM_END on success.
+ */
+enum xz_ret
+xz_decode_stream(const uint8_t *in, const struct xz_stream_info *info,
+        uint8_t *out)
+{
+    struct xz_dec *dec = xz_dec_init(XZ_SINGLE, 0);
+    if (!dec)
+        return XZ_MEM_ERROR;
+
+    struct xz_buf b = {
+        .in         = in + info->in_offset,
+        .in_size    = info->in_size,
+        .out        = out,
+        .out_size   = info->out_size,
+    };
+    enum xz_ret ret = xz_dec_run(dec, &b);
+    xz_dec_end(dec);
+
+    if (ret == XZ_STREAM_END && b.out_pos != info->out_size)
+        ret = XZ_DATA_ERROR;
+
+    return ret;
+}
@@ -0,0 +1,25 @@
+#ifndef BOOTLOADER_XZSTREAM_H
+#define BOOTLOADER_XZSTREAM_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include "xz.h"
+
+/* Location of one stream in a (possibly multi-stream) .xz file */
+struct xz_stream_info
+{
+    size_t in_offset;       /* Offset of the Stream Header */
+    size_t in_size;         /* Size from Stream Header through Stream Footer */
+    size_t out_size;        /* Uncompressed size */
+};
+
+ssize_t
+xz_find_streams(const uint8_t *in, size_t in_size,
+        struct xz_stream_info **streams);
+
+enum xz_ret
+xz_decode_stream(const uint8_t *in, const struct xz_stream_info *info,
+        uint8_t *out);
+
+#endif /* BOOTLOADER_XZSTREAM_H */
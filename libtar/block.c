@@ -20,6 +20,36 @@
 #define BIT_ISSET(bitmask, bit) ((bitmask) & (bit))
 
 
+/* read file data in as few calls as possible */
+int
+tar_data_read(TAR *t, void *buf, size_t len)
+{
+	ssize_t i;
+
+	while (len > 0)
+	{
+		i = (*(t->type->readfunc))(t->fd, buf, len);
+		if (i == -1)
+		{
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		if (i == 0)
+		{
+			/* premature end of tarchive */
+			errno = EINVAL;
+			return -1;
+		}
+
+		buf = (char *)buf + i;
+		len -= i;
+	}
+
+	return 0;
+}
+
+
 /* read a header block */
 static int
 th_read_internal(TAR *t)
@@ -95,10 +125,7 @@ th_read(TAR *t)
 	printf("==> th_read(t=0x%p)\n", t);
 #endif
 
-	if (t->th_buf.gnu_longname != NULL)
-		free(t->th_buf.gnu_longname);
-	if (t->th_buf.gnu_longlink != NULL)
-		free(t->th_buf.gnu_longlink);
+	/* GNU long names are allocated from t->arena, freed by tar_close() */
 	memset(&(t->th_buf), 0, sizeof(struct tar_header));
 
 	i = th_read_internal(t);
@@ -125,7 +152,8 @@ th_read(TAR *t)
 		printf("    th_read(): GNU long linkname detected "
 		       "(%zd bytes, %zd blocks)\n", sz, blocks);
 #endif
-		t->th_buf.gnu_longlink = (char *)malloc(blocks * T_BLOCKSIZE);
+		t->th_buf.gnu_longlink = (char *)libtar_arena_alloc(&t->arena,
+						blocks * T_BLOCKSIZE);
 		if (t->th_buf.gnu_longlink == NULL)
 			return -1;
 
@@ -175,7 +203,8 @@ th_read(TAR *t)
 		printf("    th_read(): GNU long filename detected "
 		       "(%zd bytes, %zd blocks)\n", sz, blocks);
 #endif
-		t->th_buf.gnu_longname = (char *)malloc(blocks * T_BLOCKSIZE);
+		t->th_buf.gnu_longname = (char *)libtar_arena_alloc(&t->arena,
+						blocks * T_BLOCKSIZE);
 		if (t->th_buf.gnu_longname == NULL)
 			return -1;
 
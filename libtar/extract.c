@@ -10,10 +10,12 @@
 **  University of Illinois at Urbana-Champaign
 */
 
+#define _GNU_SOURCE		/* for fallocate() */
 #include <stdio.h>
 #include <string.h>
 #include <sys/param.h>
 #include <sys/types.h>
+#include <sys/stat.h>
 #include <sys/sysmacros.h>
 #include <fcntl.h>
 #include <errno.h>
@@ -22,6 +24,37 @@
 #include <unistd.h>
 #include <libgen.h>
 #include "libtar.h"
+#include "compat.h"
+
+/*
+** with TAR_NOCHMOD, files are created with their mode, which the umask may
+** take bits from; restore them if so (the usual umask takes none of a
+** mode without group or other write permission)
+*/
+static int
+fix_created_mode(TAR *t, int fd, mode_t mode)
+{
+	static mode_t mask = (mode_t)-1;
+
+	if (!(t->options & TAR_NOCHMOD))
+		return 0;
+
+	if (mask == (mode_t)-1)
+	{
+		mask = umask(0);
+		umask(mask);
+	}
+
+	if ((mode & mask) && fchmod(fd, mode) == -1)
+	{
+#ifdef DEBUG
+		perror("fchmod()");
+#endif
+		return -1;
+	}
+
+	return 0;
+}
 
 static int mkdirs_for(const char *filename)
 {
@@ -50,13 +83,12 @@ tar_set_file_perms(TAR *t, char *realname)
 	char *filename;
 
 	filename = (realname ? realname : th_get_pathname(t));
-	mode = th_get_mode(t);
-	uid = th_get_uid(t);
-	gid = th_get_gid(t);
-	ut.modtime = ut.actime = th_get_mtime(t);
 
 	/* change owner/group */
-	if (geteuid() == 0)
+	if (!(t->options & TAR_NOOWNER) && geteuid() == 0)
+	{
+		uid = th_get_uid(t);
+		gid = th_get_gid(t);
 #ifdef HAVE_LCHOWN
 		if (lchown(filename, uid, gid) == -1)
 		{
@@ -74,23 +106,35 @@ tar_set_file_perms(TAR *t, char *realname)
 #endif /* HAVE_LCHOWN */
 			return -1;
 		}
+	}
+
+	if (TH_ISSYM(t))
+		return 0;
 
 	/* change access/modification time */
-	if (!TH_ISSYM(t) && utime(filename, &ut) == -1)
+	if (!(t->options & TAR_NOMTIME))
 	{
+		ut.modtime = ut.actime = th_get_mtime(t);
+		if (utime(filename, &ut) == -1)
+		{
 #ifdef DEBUG
-		perror("utime()");
+			perror("utime()");
 #endif
-		return -1;
+			return -1;
+		}
 	}
 
 	/* change permissions */
-	if (!TH_ISSYM(t) && chmod(filename, mode) == -1)
+	if (!(t->options & TAR_NOCHMOD))
 	{
+		mode = th_get_mode(t);
+		if (chmod(filename, mode) == -1)
+		{
 #ifdef DEBUG
-		perror("chmod()");
+			perror("chmod()");
 #endif
-		return -1;
+			return -1;
+		}
 	}
 
 	return 0;
@@ -102,9 +146,6 @@ int
 tar_extract_file(TAR *t, char *realname)
 {
 	int i;
-	char *lnp;
-	int pathname_len;
-	int realname_len;
 
 	if (t->options & TAR_NOOVERWRITE)
 	{
@@ -143,20 +184,136 @@ tar_extract_file(TAR *t, char *realname)
 	if (i != 0)
 		return i;
 
-	pathname_len = strlen(th_get_pathname(t)) + 1;
-	realname_len = strlen(realname) + 1;
-	lnp = (char *)calloc(1, pathname_len + realname_len);
-	if (lnp == NULL)
-		return -1;
-	strcpy(&lnp[0], th_get_pathname(t));
-	strcpy(&lnp[pathname_len], realname);
 #ifdef DEBUG
-	printf("tar_extract_file(): calling libtar_hash_add(): key=\"%s\", "
+	printf("tar_extract_file(): calling libtar_strmap_put(): key=\"%s\", "
 	       "value=\"%s\"\n", th_get_pathname(t), realname);
 #endif
-	if (libtar_hash_add(t->h, lnp) != 0)
+	if (libtar_strmap_put(&t->names, &t->arena, th_get_pathname(t),
+			      realname) != 0)
+		return -1;
+
+	return 0;
+}
+
+
+/* write all of buf to fd */
+static int
+write_all(int fd, const char *buf, size_t len)
+{
+	ssize_t n;
+
+	while (len > 0)
+	{
+		n = write(fd, buf, len);
+		if (n == -1)
+		{
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		buf += n;
+		len -= n;
+	}
+
+	return 0;
+}
+
+
+/* get the buffer for reading file data in chunks */
+static char *
+data_chunk(TAR *t)
+{
+	if (t->chunk == NULL)
+		t->chunk = malloc(t->chunksize);
+	return t->chunk;
+}
+
+/* write the contents of the current regular file to fdout a block at a
+   time (see TAR_WRITE_BLOCKS) */
+static int
+extract_regfile_blocks(TAR *t, int fdout, size_t size)
+{
+	char buf[T_BLOCKSIZE];
+	size_t i, n;
+	int k;
+
+	for (i = size; i > 0; i -= n)
+	{
+		k = tar_block_read(t, buf);
+		if (k != T_BLOCKSIZE)
+		{
+			if (k != -1)
+				errno = EINVAL;
+			return -1;
+		}
+
+		/* write block to output file */
+		n = (i > T_BLOCKSIZE ? T_BLOCKSIZE : i);
+		if (write_all(fdout, buf, n) == -1)
+			return -1;
+	}
+
+	return 0;
+}
+
+/* allocate the space for a file before writing it (see TAR_PREALLOCATE);
+   this is only a hint, so failure is not an error */
+static void
+preallocate(int fd, size_t size)
+{
+#ifdef __linux__
+	if (fallocate(fd, 0, 0, size) == -1)
+	{
+# ifdef DEBUG
+		perror("fallocate()");
+# endif
+	}
+#endif
+}
+
+/* write the contents of the current regular file to fdout */
+static int
+extract_regfile_data(TAR *t, int fdout, size_t size)
+{
+	size_t remain, n;
+	char *buf;
+	const char *data;
+
+	if (t->options & TAR_WRITE_BLOCKS)
+		return extract_regfile_blocks(t, fdout, size);
+
+	/* only worthwhile for files written in more than one go */
+	if ((t->options & TAR_PREALLOCATE) && size > t->chunksize)
+		preallocate(fdout, size);
+
+	/* write the file straight from the tarchive, if it is in memory */
+	if (size > 0 && (data = tar_data_map(t, T_PADDED_SIZE(size))) != NULL)
+	{
+		for (; size > 0; size -= n, data += n)
+		{
+			n = (size > t->chunksize ? t->chunksize : size);
+			if (write_all(fdout, data, n) == -1)
+				return -1;
+		}
+		return 0;
+	}
+
+	if (size > 0 && (buf = data_chunk(t)) == NULL)
 		return -1;
 
+	/* extract the file, a chunk at a time */
+	for (remain = T_PADDED_SIZE(size); remain > 0; remain -= n)
+	{
+		n = (remain > t->chunksize ? t->chunksize : remain);
+		if (tar_data_read(t, buf, n) == -1)
+			return -1;
+
+		/* write chunk (less any padding) to output file */
+		if (write_all(fdout, buf, (n > size ? size : n)) == -1)
+			return -1;
+		size -= (n > size ? size : n);
+	}
+
 	return 0;
 }
 
@@ -167,11 +324,7 @@ tar_extract_regfile(TAR *t, char *realname)
 {
 	mode_t mode;
 	size_t size;
-	uid_t uid;
-	gid_t gid;
 	int fdout;
-	int i, k;
-	char buf[T_BLOCKSIZE];
 	char *filename;
 
 #ifdef DEBUG
@@ -188,25 +341,19 @@ tar_extract_regfile(TAR *t, char *realname)
 	filename = (realname ? realname : th_get_pathname(t));
 	mode = th_get_mode(t);
 	size = th_get_size(t);
-	uid = th_get_uid(t);
-	gid = th_get_gid(t);
-
-	(void)mode;
-	(void)uid;
-	(void)gid;
 
 	if (mkdirs_for(filename) == -1)
 		return -1;
 
 #ifdef DEBUG
 	printf("  ==> extracting: %s (mode %04o, uid %d, gid %d, %zd bytes)\n",
-	       filename, mode, uid, gid, size);
+	       filename, mode, th_get_uid(t), th_get_gid(t), size);
 #endif
 	fdout = open(filename, O_WRONLY | O_CREAT | O_TRUNC
 #ifdef O_BINARY
 		     | O_BINARY
 #endif
-		    , 0666);
+		    , (t->options & TAR_NOCHMOD) ? (mode & 07777) : 0666);
 	if (fdout == -1)
 	{
 #ifdef DEBUG
@@ -215,6 +362,12 @@ tar_extract_regfile(TAR *t, char *realname)
 		return -1;
 	}
 
+	if (fix_created_mode(t, fdout, mode & 07777) == -1)
+	{
+		close(fdout);
+		return -1;
+	}
+
 #if 0
 	/* change the owner.  (will only work if run as root) */
 	if (fchown(fdout, uid, gid) == -1 && errno != EPERM)
@@ -235,22 +388,8 @@ tar_extract_regfile(TAR *t, char *realname)
 	}
 #endif
 
-	/* extract the file */
-	for (i = size; i > 0; i -= T_BLOCKSIZE)
-	{
-		k = tar_block_read(t, buf);
-		if (k != T_BLOCKSIZE)
-		{
-			if (k != -1)
-				errno = EINVAL;
-			return -1;
-		}
-
-		/* write block to output file */
-		if (write(fdout, buf,
-			  ((i > T_BLOCKSIZE) ? T_BLOCKSIZE : i)) == -1)
-			return -1;
-	}
+	if (extract_regfile_data(t, fdout, size) == -1)
+		return -1;
 
 	/* close output file */
 	if (close(fdout) == -1)
@@ -268,9 +407,8 @@ tar_extract_regfile(TAR *t, char *realname)
 int
 tar_skip_regfile(TAR *t)
 {
-	int i, k;
-	size_t size;
-	char buf[T_BLOCKSIZE];
+	size_t remain, n;
+	char *buf;
 
 	if (!TH_ISREG(t))
 	{
@@ -278,16 +416,18 @@ tar_skip_regfile(TAR *t)
 		return -1;
 	}
 
-	size = th_get_size(t);
-	for (i = size; i > 0; i -= T_BLOCKSIZE)
+	remain = T_PADDED_SIZE(th_get_size(t));
+	if (remain > 0 && tar_data_map(t, remain) != NULL)
+		return 0;
+
+	if (remain > 0 && (buf = data_chunk(t)) == NULL)
+		return -1;
+
+	for (; remain > 0; remain -= n)
 	{
-		k = tar_block_read(t, buf);
-		if (k != T_BLOCKSIZE)
-		{
-			if (k != -1)
-				errno = EINVAL;
+		n = (remain > t->chunksize ? t->chunksize : remain);
+		if (tar_data_read(t, buf, n) == -1)
 			return -1;
-		}
 	}
 
 	return 0;
@@ -299,9 +439,7 @@ int
 tar_extract_hardlink(TAR * t, char *realname)
 {
 	char *filename;
-	char *linktgt = NULL;
-	char *lnp;
-	libtar_hashptr_t hp;
+	const char *linktgt = NULL;
 
 	if (!TH_ISLNK(t))
 	{
@@ -312,14 +450,7 @@ tar_extract_hardlink(TAR * t, char *realname)
 	filename = (realname ? realname : th_get_pathname(t));
 	if (mkdirs_for(filename) == -1)
 		return -1;
-	libtar_hashptr_reset(&hp);
-	if (libtar_hash_getkey(t->h, &hp, th_get_linkname(t),
-			       (libtar_matchfunc_t)libtar_str_match) != 0)
-	{
-		lnp = (char *)libtar_hashptr_data(&hp);
-		linktgt = &lnp[strlen(lnp) + 1];
-	}
-	else
+	if (libtar_strmap_get(&t->names, th_get_linkname(t), &linktgt) == 0)
 		linktgt = th_get_linkname(t);
 
 #ifdef DEBUG
@@ -539,3 +670,248 @@ tar_extract_fifo(TAR *t, char *realname)
 }
 
 
+
+
+/*
+** directory-relative extraction
+**
+** tar_extract_file_at() extracts relative to an open directory, using the
+** *at() system calls, and sets permissions and times through the open file
+** where possible.  directories which are known to exist are remembered in
+** t->dirs, so each file costs a single path lookup.
+*/
+
+/* remember that a directory exists */
+static int
+dirs_add(TAR *t, const char *name)
+{
+	return libtar_strmap_put(&t->dirs, &t->arena, name, NULL);
+}
+
+/* returns 1 if a directory is known to exist */
+static int
+dirs_find(TAR *t, const char *name)
+{
+	return libtar_strmap_get(&t->dirs, name, NULL);
+}
+
+/* create the parent directories of name, relative to dirfd */
+static int
+mkdirs_for_at(TAR *t, int dirfd, const char *name)
+{
+	char path[MAXPATHLEN];
+	char *p;
+
+	if (strlcpy(path, name, sizeof(path)) >= sizeof(path))
+	{
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+
+	for (p = strchr(path, '/'); p != NULL; p = strchr(p + 1, '/'))
+	{
+		if (p == path)
+			continue;
+
+		*p = '\0';
+		if (!dirs_find(t, path))
+		{
+			if (mkdirat(dirfd, path, 0777) == -1 && errno != EEXIST)
+				return -1;
+			if (dirs_add(t, path) == -1)
+				return -1;
+		}
+		*p = '/';
+	}
+
+	return 0;
+}
+
+/* set owner, times and mode of the current file: via fd if >= 0 */
+static int
+set_file_perms_at(TAR *t, int dirfd, const char *name, int fd)
+{
+	mode_t mode;
+	struct timespec ts[2];
+
+	/* change owner/group */
+	if (!(t->options & TAR_NOOWNER) && geteuid() == 0)
+	{
+		uid_t uid = th_get_uid(t);
+		gid_t gid = th_get_gid(t);
+
+		if ((fd >= 0 ? fchown(fd, uid, gid)
+			     : fchownat(dirfd, name, uid, gid,
+					AT_SYMLINK_NOFOLLOW)) == -1)
+		{
+#ifdef DEBUG
+			perror("fchown()");
+#endif
+			return -1;
+		}
+	}
+
+	if (TH_ISSYM(t))
+		return 0;
+
+	/* change access/modification time */
+	if (!(t->options & TAR_NOMTIME))
+	{
+		ts[0].tv_sec = ts[1].tv_sec = th_get_mtime(t);
+		ts[0].tv_nsec = ts[1].tv_nsec = 0;
+
+		if ((fd >= 0 ? futimens(fd, ts)
+			     : utimensat(dirfd, name, ts, 0)) == -1)
+		{
+#ifdef DEBUG
+			perror("futimens()");
+#endif
+			return -1;
+		}
+	}
+
+	/* change permissions */
+	if (!(t->options & TAR_NOCHMOD))
+	{
+		mode = th_get_mode(t);
+		if ((fd >= 0 ? fchmod(fd, mode)
+			     : fchmodat(dirfd, name, mode, 0)) == -1)
+		{
+#ifdef DEBUG
+			perror("fchmod()");
+#endif
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+/* returns the open file, so permissions can be set through it */
+static int
+extract_regfile_at(TAR *t, int dirfd, const char *name)
+{
+	int fdout;
+
+	fdout = openat(dirfd, name, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+		       (t->options & TAR_NOCHMOD)
+		       ? (th_get_mode(t) & 07777) : 0666);
+	if (fdout == -1)
+	{
+#ifdef DEBUG
+		perror("openat()");
+#endif
+		return -1;
+	}
+
+	if (fix_created_mode(t, fdout, th_get_mode(t) & 07777) == -1)
+	{
+		close(fdout);
+		return -1;
+	}
+
+	if (extract_regfile_data(t, fdout, th_get_size(t)) == -1)
+	{
+		close(fdout);
+		return -1;
+	}
+
+	return fdout;
+}
+
+static int
+extract_hardlink_at(TAR *t, int dirfd, const char *name)
+{
+	const char *linktgt;
+
+	if (libtar_strmap_get(&t->names, th_get_linkname(t), &linktgt) == 0)
+		linktgt = th_get_linkname(t);
+
+	return linkat(dirfd, linktgt, dirfd, name, 0);
+}
+
+static int
+extract_symlink_at(TAR *t, int dirfd, const char *name)
+{
+	if (unlinkat(dirfd, name, 0) == -1 && errno != ENOENT)
+		return -1;
+
+	return symlinkat(th_get_linkname(t), dirfd, name);
+}
+
+static int
+extract_dir_at(TAR *t, int dirfd, const char *name)
+{
+	if (mkdirat(dirfd, name, th_get_mode(t)) == -1 && errno != EEXIST)
+		return -1;
+
+	return dirs_add(t, name);
+}
+
+/* sequentially extract next file from t, to name relative to dirfd */
+int
+tar_extract_file_at(TAR *t, int dirfd, const char *name)
+{
+	mode_t mode;
+	dev_t dev;
+	int fd = -1;
+	int i;
+
+	/* always relative to dirfd */
+	while (*name == '/')
+		name++;
+
+#ifdef DEBUG
+	printf("==> tar_extract_file_at(t=0x%p, dirfd=%d, name=\"%s\")\n",
+	       t, dirfd, name);
+#endif
+
+	if (t->options & TAR_NOOVERWRITE)
+	{
+		struct stat s;
+
+		if (fstatat(dirfd, name, &s, AT_SYMLINK_NOFOLLOW) == 0
+		    || errno != ENOENT)
+		{
+			errno = EEXIST;
+			return -1;
+		}
+	}
+
+	if (mkdirs_for_at(t, dirfd, name) == -1)
+		return -1;
+
+	mode = th_get_mode(t);
+	dev = makedev(th_get_devmajor(t), th_get_devminor(t));
+
+	if (TH_ISDIR(t))
+		i = extract_dir_at(t, dirfd, name);
+	else if (TH_ISLNK(t))
+		i = extract_hardlink_at(t, dirfd, name);
+	else if (TH_ISSYM(t))
+		i = extract_symlink_at(t, dirfd, name);
+	else if (TH_ISCHR(t))
+		i = mknodat(dirfd, name, mode | S_IFCHR, dev);
+	else if (TH_ISBLK(t))
+		i = mknodat(dirfd, name, mode | S_IFBLK, dev);
+	else if (TH_ISFIFO(t))
+		i = mknodat(dirfd, name, mode | S_IFIFO, 0);
+	else /* if (TH_ISREG(t)) */
+	{
+		fd = extract_regfile_at(t, dirfd, name);
+		i = (fd == -1 ? -1 : 0);
+	}
+
+	if (i == 0)
+		i = set_file_perms_at(t, dirfd, name, fd);
+	if (fd != -1 && close(fd) == -1)
+		i = -1;
+	if (i != 0)
+		return i;
+
+	if (libtar_strmap_put(&t->names, &t->arena, th_get_pathname(t),
+			      name) != 0)
+		return -1;
+
+	return 0;
+}
@@ -41,12 +41,13 @@ tar_init(TAR **t, const char *pathname, tartype_t *type,
 	(*t)->options = options;
 	(*t)->type = (type ? type : &default_type);
 	(*t)->oflags = oflags;
+	(*t)->chunksize = T_CHUNKSIZE;
 
+	/* extracted names are kept in t->names, allocated as needed */
 	if ((oflags & O_ACCMODE) == O_RDONLY)
-		(*t)->h = libtar_hash_new(256,
-					  (libtar_hashfunc_t)path_hashfunc);
-	else
-		(*t)->h = libtar_hash_new(16, (libtar_hashfunc_t)dev_hash);
+		return 0;
+
+	(*t)->h = libtar_hash_new(16, (libtar_hashfunc_t)dev_hash);
 	if ((*t)->h == NULL)
 	{
 		free(*t);
@@ -111,12 +112,31 @@ tar_close(TAR *t)
 	i = (*(t->type->closefunc))(t->fd);
 
 	if (t->h != NULL)
-		libtar_hash_free(t->h, ((t->oflags & O_ACCMODE) == O_RDONLY
-					? free
-					: (libtar_freefunc_t)tar_dev_free));
+		libtar_hash_free(t->h, (libtar_freefunc_t)tar_dev_free);
+	libtar_arena_free(&t->arena);
+	free(t->chunk);
 	free(t);
 
 	return i;
 }
 
 
+/* set the size of the chunks file data is read and written in */
+int
+tar_set_chunksize(TAR *t, size_t size)
+{
+	if (size < T_BLOCKSIZE)
+	{
+		errno = EINVAL;
+		return -1;
+	}
+
+	/* the buffer is allocated on first use */
+	free(t->chunk);
+	t->chunk = NULL;
+	t->chunksize = size / T_BLOCKSIZE * T_BLOCKSIZE;
+
+	return 0;
+}
+
+
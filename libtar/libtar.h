@@ -27,6 +27,7 @@ extern "C"
 
 /* useful constants */
 #define T_BLOCKSIZE		512
+#define T_CHUNKSIZE		(1024 * 1024)	/* default for file data */
 #define T_NAMELEN		100
 #define T_PREFIXLEN		155
 #define T_MAXPATHLEN		(T_NAMELEN + T_PREFIXLEN)
@@ -66,6 +67,7 @@ typedef int (*openfunc_t)(const char *, int, ...);
 typedef int (*closefunc_t)(int);
 typedef ssize_t (*readfunc_t)(int, void *, size_t);
 typedef ssize_t (*writefunc_t)(int, const void *, size_t);
+typedef const void *(*mapfunc_t)(int, size_t);
 
 typedef struct
 {
@@ -73,6 +75,13 @@ typedef struct
 	closefunc_t closefunc;
 	readfunc_t readfunc;
 	writefunc_t writefunc;
+
+	/*
+	 * optional: for tarchives already in memory, return a pointer to the
+	 * next len bytes and skip past them (or NULL if not available), so
+	 * file contents can be written out without being copied
+	 */
+	mapfunc_t mapfunc;
 }
 tartype_t;
 
@@ -84,7 +93,12 @@ typedef struct
 	int oflags;
 	int options;
 	struct tar_header th_buf;
-	libtar_hash_t *h;
+	libtar_hash_t *h;	/* devices/inodes appended (write mode) */
+	libtar_arena_t arena;	/* storage for names, dirs and long names */
+	libtar_strmap_t names;	/* extracted files: pathname -> realname */
+	libtar_strmap_t dirs;	/* directories known to exist (*_at) */
+	char *chunk;		/* buffer for file data */
+	size_t chunksize;	/* size of chunk (T_CHUNKSIZE by default) */
 }
 TAR;
 
@@ -96,6 +110,13 @@ TAR;
 #define TAR_CHECK_MAGIC		16	/* check magic in file header */
 #define TAR_CHECK_VERSION	32	/* check version in file header */
 #define TAR_IGNORE_CRC		64	/* ignore CRC in file header */
+#define TAR_WRITE_BLOCKS	128	/* write file data a block at a time */
+#define TAR_PREALLOCATE		256	/* preallocate files before writing */
+#define TAR_NOOWNER		512	/* don't look up or restore owners */
+#define TAR_NOMTIME		1024	/* don't restore modification times */
+#define TAR_NOCHMOD		2048	/* create files with their mode instead
+					   of chmod()ing them (unless the
+					   umask takes some of it away) */
 
 /* this is obsolete - it's here for backwards-compatibility only */
 #define TAR_IGNORE_MAGIC	0
@@ -117,6 +138,9 @@ int tar_fd(TAR *t);
 /* close tarfile handle */
 int tar_close(TAR *t);
 
+/* set the size of the chunks file data is read and written in */
+int tar_set_chunksize(TAR *t, size_t size);
+
 
 /***** append.c ************************************************************/
 
@@ -149,6 +173,19 @@ int tar_append_regfile(TAR *t, const char *realname);
 #define tar_block_write(t, buf) \
 	(*((t)->type->writefunc))((t)->fd, (char *)(buf), T_BLOCKSIZE)
 
+/* read len bytes of file data (padded to whole blocks) in as few calls as
+   possible; returns 0, or -1 and sets errno */
+int tar_data_read(TAR *t, void *buf, size_t len);
+
+/* map the next len bytes of a tarchive, if supported (see tartype_t) */
+#define tar_data_map(t, len) \
+	((t)->type->mapfunc != NULL \
+	 ? (*((t)->type->mapfunc))((t)->fd, (len)) : NULL)
+
+/* size of file data, including padding to a whole number of blocks */
+#define T_PADDED_SIZE(size) \
+	(((size) + T_BLOCKSIZE - 1) / T_BLOCKSIZE * T_BLOCKSIZE)
+
 /* read/write a header block */
 int th_read(TAR *t);
 int th_write(TAR *t);
@@ -220,6 +257,9 @@ void th_finish(TAR *t);
 /* sequentially extract next file from t */
 int tar_extract_file(TAR *t, char *realname);
 
+/* sequentially extract next file from t, to name relative to dirfd */
+int tar_extract_file_at(TAR *t, int dirfd, const char *name);
+
 /* extract different file types */
 int tar_extract_dir(TAR *t, char *realname);
 int tar_extract_hardlink(TAR *t, char *realname);
@@ -287,6 +327,7 @@ void int_to_oct_nonull(int num, char *oct, size_t octlen);
 /* extract groups of files */
 int tar_extract_glob(TAR *t, char *globname, char *prefix);
 int tar_extract_all(TAR *t, char *prefix);
+int tar_extract_all_at(TAR *t, int dirfd);
 
 /* add a whole tree of files */
 int tar_append_tree(TAR *t, char *realdir, char *savedir);
@@ -0,0 +1,105 @@
+/*
+**  libtar_arena.c - bump allocator
+**
+**  Memory is handed out from large blocks and freed all at once, so
+**  that a tar handle's bookkeeping costs a few malloc() calls rather
+**  than several per archive member.
+*/
+
+#include <stdio.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "listhash.h"
+#include "compat.h"
+
+
+#define ARENA_BLOCKSIZE	(64 * 1024)
+#define ARENA_ALIGN	16
+
+struct libtar_arena_block
+{
+	struct libtar_arena_block *next;
+	size_t size;
+	size_t used;
+	/* data follows, aligned to ARENA_ALIGN */
+};
+
+#define BLOCK_HDRSIZE \
+	((sizeof(struct libtar_arena_block) + ARENA_ALIGN - 1) \
+	 & ~(size_t)(ARENA_ALIGN - 1))
+
+
+/*
+** libtar_arena_alloc() - allocate memory from an arena
+*/
+void *
+libtar_arena_alloc(libtar_arena_t *a, size_t size)
+{
+	struct libtar_arena_block *b = a->first;
+	size_t bsize;
+	void *p;
+
+	size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+
+	if (b == NULL || b->size - b->used < size)
+	{
+		bsize = (size > ARENA_BLOCKSIZE ? size : ARENA_BLOCKSIZE);
+		b = (struct libtar_arena_block *)malloc(BLOCK_HDRSIZE + bsize);
+		if (b == NULL)
+			return NULL;
+		b->size = bsize;
+		b->used = 0;
+
+		/* keep allocating from the current block if this one is
+		   only for a large allocation */
+		if (a->first != NULL && bsize > ARENA_BLOCKSIZE)
+		{
+			b->next = a->first->next;
+			a->first->next = b;
+		}
+		else
+		{
+			b->next = a->first;
+			a->first = b;
+		}
+	}
+
+	p = (char *)b + BLOCK_HDRSIZE + b->used;
+	b->used += size;
+	return p;
+}
+
+
+/*
+** libtar_arena_strdup() - copy a string into an arena
+*/
+char *
+libtar_arena_strdup(libtar_arena_t *a, const char *s)
+{
+	size_t len = strlen(s) + 1;
+	char *p;
+
+	p = (char *)libtar_arena_alloc(a, len);
+	if (p != NULL)
+		memcpy(p, s, len);
+	return p;
+}
+
+
+/*
+** libtar_arena_free() - free all of the memory in an arena
+*/
+void
+libtar_arena_free(libtar_arena_t *a)
+{
+	struct libtar_arena_block *b, *next;
+
+	for (b = a->first; b != NULL; b = next)
+	{
+		next = b->next;
+		free(b);
+	}
+	a->first = NULL;
+}
@@ -13,6 +13,8 @@
 #ifndef libtar_LISTHASH_H
 #define libtar_LISTHASH_H
 
+#include <stddef.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -203,6 +205,62 @@ int libtar_hash_add(libtar_hash_t *, void *);
 int libtar_hash_del(libtar_hash_t *,
 			       libtar_hashptr_t *);
 
+
+/***** arena.c *********************************************************/
+
+/*
+** Bump allocator: memory is allocated in blocks, and all of it is freed
+** at once.  A zero-initialized arena is empty and ready to use.
+*/
+struct libtar_arena_block;
+
+struct libtar_arena
+{
+	struct libtar_arena_block *first;
+};
+typedef struct libtar_arena libtar_arena_t;
+
+/* allocate size bytes, suitably aligned for any type */
+void *libtar_arena_alloc(libtar_arena_t *, size_t);
+
+/* copy a string into the arena */
+char *libtar_arena_strdup(libtar_arena_t *, const char *);
+
+/* free everything allocated from the arena */
+void libtar_arena_free(libtar_arena_t *);
+
+
+/***** strmap.c ********************************************************/
+
+/*
+** Map of strings to strings, using open addressing.  Keys and values
+** are copied into an arena, which is also used for the table itself,
+** so the map is freed along with the arena.  A zero-initialized map is
+** empty and ready to use.
+*/
+struct libtar_strmap_ent
+{
+	const char *key;
+	const char *value;
+	unsigned int hash;
+};
+
+struct libtar_strmap
+{
+	struct libtar_strmap_ent *table;
+	unsigned int size;	/* power of 2, or 0 */
+	unsigned int nents;
+};
+typedef struct libtar_strmap libtar_strmap_t;
+
+/* add or replace an entry; value may be NULL */
+int libtar_strmap_put(libtar_strmap_t *, libtar_arena_t *,
+			     const char *, const char *);
+
+/* return 1 and set *value if the key is found, 0 otherwise */
+int libtar_strmap_get(libtar_strmap_t *, const char *,
+			     const char **);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,141 @@
+/*
+**  libtar_strmap.c - string map routines
+**
+**  An open-addressing (linear probing) hash table of strings, with its
+**  table, keys and values all allocated from an arena.
+*/
+
+#include <stdio.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "listhash.h"
+#include "compat.h"
+
+
+#define STRMAP_MINSIZE	64
+
+
+/* FNV-1a */
+static unsigned int
+strmap_hash(const char *key)
+{
+	unsigned int h = 2166136261U;
+
+	for (; *key != '\0'; key++)
+	{
+		h ^= (unsigned char)*key;
+		h *= 16777619U;
+	}
+
+	return h;
+}
+
+
+/* find the slot for a key: either its entry, or an empty slot */
+static struct libtar_strmap_ent *
+strmap_slot(struct libtar_strmap_ent *table, unsigned int size,
+	    const char *key, unsigned int hash)
+{
+	unsigned int i;
+
+	for (i = hash & (size - 1); table[i].key != NULL;
+	     i = (i + 1) & (size - 1))
+	{
+		if (table[i].hash == hash && strcmp(table[i].key, key) == 0)
+			break;
+	}
+
+	return &table[i];
+}
+
+
+/* double the size of the table (the old one stays in the arena) */
+static int
+strmap_grow(libtar_strmap_t *m, libtar_arena_t *a)
+{
+	struct libtar_strmap_ent *table, *ent;
+	unsigned int size, i;
+
+	size = (m->size ? m->size * 2 : STRMAP_MINSIZE);
+	table = (struct libtar_strmap_ent *)
+		libtar_arena_alloc(a, size * sizeof(*table));
+	if (table == NULL)
+		return -1;
+	memset(table, 0, size * sizeof(*table));
+
+	for (i = 0; i < m->size; i++)
+	{
+		if (m->table[i].key == NULL)
+			continue;
+		ent = strmap_slot(table, size, m->table[i].key,
+				  m->table[i].hash);
+		*ent = m->table[i];
+	}
+
+	m->table = table;
+	m->size = size;
+	return 0;
+}
+
+
+/*
+** libtar_strmap_put() - add or replace an entry
+** returns:
+**	0			success
+**	-1 (and sets errno)	failure
+*/
+int
+libtar_strmap_put(libtar_strmap_t *m, libtar_arena_t *a,
+		  const char *key, const char *value)
+{
+	struct libtar_strmap_ent *ent;
+	unsigned int hash;
+
+	/* keep the table at most half full */
+	if ((m->nents + 1) * 2 > m->size && strmap_grow(m, a) == -1)
+		return -1;
+
+	hash = strmap_hash(key);
+	ent = strmap_slot(m->table, m->size, key, hash);
+	if (ent->key == NULL)
+	{
+		ent->key = libtar_arena_strdup(a, key);
+		if (ent->key == NULL)
+			return -1;
+		ent->hash = hash;
+		m->nents++;
+	}
+
+	ent->value = NULL;
+	if (value != NULL
+	    && (ent->value = libtar_arena_strdup(a, value)) == NULL)
+		return -1;
+
+	return 0;
+}
+
+
+/*
+** libtar_strmap_get() - look up a key
+** returns:
+**	1			found (*value is set if value is not NULL)
+**	0			not found
+*/
+int
+libtar_strmap_get(libtar_strmap_t *m, const char *key, const char **value)
+{
+	struct libtar_strmap_ent *ent;
+
+	if (m->size == 0)
+		return 0;
+
+	ent = strmap_slot(m->table, m->size, key, strmap_hash(key));
+	if (ent->key == NULL)
+		return 0;
+
+	if (value != NULL)
+		*value = ent->value;
+	return 1;
+}
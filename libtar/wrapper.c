@@ -86,6 +86,28 @@ tar_extract_all(TAR *t, char *prefix)
 }
 
 
+/* like tar_extract_all(), but relative to an open directory */
+int
+tar_extract_all_at(TAR *t, int dirfd)
+{
+	int i;
+
+#ifdef DEBUG
+	printf("==> tar_extract_all_at(TAR *t, %d)\n", dirfd);
+#endif
+
+	while ((i = th_read(t)) == 0)
+	{
+		if (t->options & TAR_VERBOSE)
+			th_print_long_ls(t);
+		if (tar_extract_file_at(t, dirfd, th_get_pathname(t)) != 0)
+			return -1;
+	}
+
+	return (i == 1 ? 0 : -1);
+}
+
+
 int
 tar_append_tree(TAR *t, char *realdir, char *savedir)
 {
@@ -0,0 +1,113 @@
+/*
+ * CRC64 using the polynomial from ECMA-182
+ *
+ * Authors: Lasse Collin <lasse.collin@tukaani.org>
+ *          Igor Pavlov <http://7-zip.org/>
+ *
+ * This file has been put into the public domain.
+ * You can do whatever you want with this file.
+ */
+
+/*
+ * Like xz_crc32.c: slicing-by-8 (16 KiB of tables), or on x86-64 with
+ * PCLMULQDQ, carry-less multiplication, chosen by xz_crc64_init().
+ */
+
+#include "xz_private.h"
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#	define XZ_CRC64_CLMUL
+#	include "xz_crc_clmul.h"
+#endif
+
+#ifndef STATIC_RW_DATA
+#	define STATIC_RW_DATA static
+#endif
+
+STATIC_RW_DATA uint64_t xz_crc64_table[8][256];
+
+/* Update the CRC state, which is the inverse of the CRC value */
+static uint64_t crc64_generic(const uint8_t *buf, size_t size, uint64_t crc)
+{
+	const uint64_t (*t)[256] = xz_crc64_table;
+	uint64_t a;
+
+	while (size >= 8) {
+		a = crc ^ ((uint64_t)get_unaligned_le32(buf)
+				| ((uint64_t)get_unaligned_le32(buf + 4) << 32));
+		crc = t[7][a & 0xFF] ^ t[6][(a >> 8) & 0xFF]
+				^ t[5][(a >> 16) & 0xFF] ^ t[4][(a >> 24) & 0xFF]
+				^ t[3][(a >> 32) & 0xFF] ^ t[2][(a >> 40) & 0xFF]
+				^ t[1][(a >> 48) & 0xFF] ^ t[0][a >> 56];
+		buf += 8;
+		size -= 8;
+	}
+
+	while (size != 0) {
+		crc = t[0][*buf++ ^ (crc & 0xFF)] ^ (crc >> 8);
+		--size;
+	}
+
+	return crc;
+}
+
+#ifdef XZ_CRC64_CLMUL
+static const struct xz_crc_clmul_consts crc64_clmul_consts = {
+	{ 0x6AE3EFBB9DD441F3, 0x081F6054A7842DF4 },
+	{ 0xE05DD497CA393AE4, 0xDABE95AFC7875F40 },
+};
+
+static uint64_t crc64_clmul(const uint8_t *buf, size_t size, uint64_t crc)
+{
+	uint8_t folded[16];
+	size_t n;
+
+	if (size < 64)
+		return crc64_generic(buf, size, crc);
+
+	n = xz_crc_clmul_fold(buf, size, crc, &crc64_clmul_consts, folded);
+	crc = crc64_generic(folded, sizeof(folded), 0);
+	return crc64_generic(buf + n, size - n, crc);
+}
+#endif
+
+static uint64_t (*crc64_update)(const uint8_t *buf, size_t size,
+		uint64_t crc) = crc64_generic;
+
+XZ_EXTERN void xz_crc64_init(void)
+{
+	const uint64_t poly = 0xC96C5795D7870F42;
+
+	uint32_t i;
+	uint32_t j;
+	uint64_t r;
+
+	for (i = 0; i < 256; ++i) {
+		r = i;
+		for (j = 0; j < 8; ++j)
+			r = (r >> 1) ^ (poly & ~((r & 1) - 1));
+
+		xz_crc64_table[0][i] = r;
+	}
+
+	/* Table j gives the effect of a byte followed by j zero bytes */
+	for (i = 0; i < 256; ++i) {
+		r = xz_crc64_table[0][i];
+		for (j = 1; j < 8; ++j) {
+			r = xz_crc64_table[0][r & 0xFF] ^ (r >> 8);
+			xz_crc64_table[j][i] = r;
+		}
+	}
+
+#ifdef XZ_CRC64_CLMUL
+	if (xz_crc_clmul_supported())
+		crc64_update = crc64_clmul;
+#endif
+
+	return;
+}
+
+XZ_EXTERN uint64_t xz_crc64(const uint8_t *buf, size_t size, uint64_t crc)
+{
+	return ~crc64_update(buf, size, ~crc);
+}
@@ -0,0 +1,114 @@
+/*
+ * CRC folding with carry-less multiplication (x86-64 PCLMULQDQ)
+ *
+ * This file has been put into the public domain.
+ * You can do whatever you want with this file.
+ */
+
+/*
+ * Based on "Fast CRC Computation for Generic Polynomials Using PCLMULQDQ
+ * Instruction" (Intel, 2009), for bit-reflected CRCs. The input is folded,
+ * 64 bytes at a time and then 16 bytes at a time, into a single 16-byte
+ * block which has the same CRC as the input. Rather than doing the final
+ * (Barrett) reduction with more multiplications, that block is finished with
+ * the table-based code, so the same folding works for CRC32 and CRC64 with
+ * only different constants.
+ *
+ * The constants are, for a bit-reflected CRC of width w with polynomial P,
+ * and a folding distance of D bits (512 or 128):
+ *
+ *   CRC32: reflect32(x^(D+32) mod P) << 1, reflect32(x^(D-32) mod P) << 1
+ *   CRC64: reflect64(x^(D+63) mod P),      reflect64(x^(D-1) mod P)
+ */
+
+#ifndef XZ_CRC_CLMUL_H
+#define XZ_CRC_CLMUL_H
+
+#include <cpuid.h>
+#include <emmintrin.h>
+#include <wmmintrin.h>
+
+struct xz_crc_clmul_consts {
+	/* Multipliers for the low and high halves of each 16-byte block */
+	uint64_t fold64[2];
+	uint64_t fold16[2];
+};
+
+static inline bool xz_crc_clmul_supported(void)
+{
+	unsigned int eax, ebx, ecx, edx;
+
+	if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+		return false;
+
+	return (ecx & bit_PCLMUL) != 0;
+}
+
+__attribute__((__target__("pclmul")))
+static inline __m128i xz_crc_clmul_fold16(__m128i x, __m128i k, __m128i next)
+{
+	__m128i lo = _mm_clmulepi64_si128(x, k, 0x00);
+	__m128i hi = _mm_clmulepi64_si128(x, k, 0x11);
+
+	return _mm_xor_si128(_mm_xor_si128(lo, hi), next);
+}
+
+/*
+ * Fold buf (size >= 64), with the CRC state crc XORed into its first bytes,
+ * into out[16]. The CRC of out, starting from a zero state, is then the state
+ * after the bytes consumed, which is returned: a multiple of 16; the rest of
+ * buf must be processed after that.
+ */
+__attribute__((__target__("pclmul")))
+static inline size_t xz_crc_clmul_fold(const uint8_t *buf, size_t size,
+		uint64_t crc, const struct xz_crc_clmul_consts *c,
+		uint8_t out[16])
+{
+	const uint8_t *start = buf;
+	__m128i k;
+	__m128i x0;
+	__m128i x1;
+	__m128i x2;
+	__m128i x3;
+
+	x0 = _mm_loadu_si128((const __m128i *)(buf + 0x00));
+	x1 = _mm_loadu_si128((const __m128i *)(buf + 0x10));
+	x2 = _mm_loadu_si128((const __m128i *)(buf + 0x20));
+	x3 = _mm_loadu_si128((const __m128i *)(buf + 0x30));
+	x0 = _mm_xor_si128(x0, _mm_cvtsi64_si128((long long)crc));
+	buf += 64;
+	size -= 64;
+
+	/* Four blocks in parallel */
+	k = _mm_loadu_si128((const __m128i *)c->fold64);
+	while (size >= 64) {
+		x0 = xz_crc_clmul_fold16(x0, k,
+			_mm_loadu_si128((const __m128i *)(buf + 0x00)));
+		x1 = xz_crc_clmul_fold16(x1, k,
+			_mm_loadu_si128((const __m128i *)(buf + 0x10)));
+		x2 = xz_crc_clmul_fold16(x2, k,
+			_mm_loadu_si128((const __m128i *)(buf + 0x20)));
+		x3 = xz_crc_clmul_fold16(x3, k,
+			_mm_loadu_si128((const __m128i *)(buf + 0x30)));
+		buf += 64;
+		size -= 64;
+	}
+
+	/* Fold them into one, then the rest of the blocks into that */
+	k = _mm_loadu_si128((const __m128i *)c->fold16);
+	x0 = xz_crc_clmul_fold16(x0, k, x1);
+	x0 = xz_crc_clmul_fold16(x0, k, x2);
+	x0 = xz_crc_clmul_fold16(x0, k, x3);
+
+	while (size >= 16) {
+		x0 = xz_crc_clmul_fold16(x0, k,
+				_mm_loadu_si128((const __m128i *)buf));
+		buf += 16;
+		size -= 16;
+	}
+
+	_mm_storeu_si128((__m128i *)out, x0);
+	return (size_t)(buf - start);
+}
+
+#endif
@@ -47,6 +47,10 @@ struct xz_dec_bcj {
 	/* x86 filter state */
 	uint32_t x86_prev_mask;
 
+	/* Integrity check updated as data is filtered (see xz_dec_bcj_check()) */
+	enum xz_check check_type;
+	xz_crc_t *crc;
+
 	/* Temporary space to hold the variables from struct xz_buf */
 	uint8_t *out;
 	size_t out_pos;
@@ -392,9 +396,50 @@ static void bcj_apply(struct xz_dec_bcj *s,
 }
 
 /*
- * Flush pending filtered data from temp to the output buffer.
- * Move the remaining mixture of possibly filtered and unfiltered
- * data to the beginning of temp.
+ * Update the integrity check with data which is final: filtered, or left
+ * unfiltered at the end of the Block.
+ */
+static void bcj_check(struct xz_dec_bcj *s, const uint8_t *buf, size_t size)
+{
+	if (s->check_type == XZ_CHECK_CRC32)
+		*s->crc = xz_crc32(buf, size, *s->crc);
+#ifdef XZ_USE_CRC64
+	else if (s->check_type == XZ_CHECK_CRC64)
+		*s->crc = xz_crc64(buf, size, *s->crc);
+#endif
+}
+
+/*
+ * bcj_apply() and bcj_check() BCJ_CHECK_CHUNK bytes at a time, so the check
+ * reads each chunk while it is still in the L1 cache. The filters keep their
+ * state across calls, so this filters the data just as one call would.
+ */
+#define BCJ_CHECK_CHUNK 4096
+
+static void bcj_apply_check(struct xz_dec_bcj *s,
+			    uint8_t *buf, size_t *pos, size_t size)
+{
+	size_t start;
+	size_t end;
+
+	if (s->check_type == XZ_CHECK_NONE) {
+		bcj_apply(s, buf, pos, size);
+		return;
+	}
+
+	do {
+		start = *pos;
+		end = size - start > BCJ_CHECK_CHUNK
+				? start + BCJ_CHECK_CHUNK : size;
+		bcj_apply(s, buf, pos, end);
+		bcj_check(s, buf + start, *pos - start);
+	} while (*pos < size && *pos > start);
+}
+
+/*
+ * Flush pending filtered data from temp to the output buffer, updating the
+ * integrity check. Move the remaining mixture of possibly filtered and
+ * unfiltered data to the beginning of temp.
  */
 static void bcj_flush(struct xz_dec_bcj *s, struct xz_buf *b)
 {
@@ -402,6 +447,7 @@ static void bcj_flush(struct xz_dec_bcj *s, struct xz_buf *b)
 
 	copy_size = min_t(size_t, s->temp.filtered, b->out_size - b->out_pos);
 	memcpy(b->out + b->out_pos, s->temp.buf, copy_size);
+	bcj_check(s, s->temp.buf, copy_size);
 	b->out_pos += copy_size;
 
 	s->temp.filtered -= copy_size;
@@ -456,15 +502,18 @@ XZ_EXTERN enum xz_ret xz_dec_bcj_run(struct xz_dec_bcj *s,
 				&& (s->ret != XZ_OK || s->single_call))
 			return s->ret;
 
-		bcj_apply(s, b->out, &out_start, b->out_pos);
+		bcj_apply_check(s, b->out, &out_start, b->out_pos);
 
 		/*
 		 * As an exception, if the next filter returned XZ_STREAM_END,
 		 * we can do that too, since the last few bytes that remain
 		 * unfiltered are meant to remain unfiltered.
 		 */
-		if (s->ret == XZ_STREAM_END)
+		if (s->ret == XZ_STREAM_END) {
+			bcj_check(s, b->out + out_start,
+					b->out_pos - out_start);
 			return XZ_STREAM_END;
+		}
 
 		s->temp.size = b->out_pos - out_start;
 		b->out_pos -= s->temp.size;
@@ -527,8 +576,11 @@ XZ_EXTERN enum xz_ret xz_dec_bcj_run(struct xz_dec_bcj *s,
 XZ_EXTERN struct xz_dec_bcj *xz_dec_bcj_create(bool single_call)
 {
 	struct xz_dec_bcj *s = kmalloc(sizeof(*s), GFP_KERNEL);
-	if (s != NULL)
+	if (s != NULL) {
 		s->single_call = single_call;
+		s->check_type = XZ_CHECK_NONE;
+		s->crc = NULL;
+	}
 
 	return s;
 }
@@ -571,4 +623,11 @@ XZ_EXTERN enum xz_ret xz_dec_bcj_reset(struct xz_dec_bcj *s, uint8_t id)
 	return XZ_OK;
 }
 
+XZ_EXTERN void xz_dec_bcj_check(struct xz_dec_bcj *s,
+				enum xz_check check_type, xz_crc_t *crc)
+{
+	s->check_type = check_type;
+	s->crc = crc;
+}
+
 #endif
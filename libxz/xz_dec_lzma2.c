@@ -89,6 +89,10 @@ struct dictionary {
 
 	/* Operation mode */
 	enum xz_mode mode;
+
+	/* Integrity check updated by dict_flush() (see xz_dec_lzma2_check()) */
+	enum xz_check check_type;
+	xz_crc_t *crc;
 };
 
 /* Range decoder */
@@ -338,6 +342,55 @@ static inline void dict_put(struct dictionary *dict, uint8_t byte)
 		dict->full = dict->pos;
 }
 
+/*
+ * Copy len bytes to dst from dist bytes before it, front to back, as LZ77
+ * defines it: if dist < len, the source overlaps the destination, and the
+ * last dist bytes before dst are repeated. Rather than a byte at a time,
+ * this copies in 16- or 8-byte chunks when the distance allows it. Shorter
+ * distances are widened first: once a whole period has been copied, the
+ * data can just as well be copied from twice as far back. (A distance of 1,
+ * common in runs of zeros, is just a memset().)
+ *
+ * Nothing is written past dst + len: in multi-call mode, the bytes after
+ * it are still part of the history.
+ */
+static __always_inline void dict_copy(uint8_t *dst, size_t dist, size_t len)
+{
+	if (dist == 1) {
+		memset(dst, dst[-1], len);
+		return;
+	}
+
+	while (dist < 8 && len > dist) {
+		memcpy(dst, dst - dist, dist);
+		dst += dist;
+		len -= dist;
+		dist *= 2;
+	}
+
+	if (dist >= 16) {
+		while (len >= 16) {
+			memcpy(dst, dst - dist, 16);
+			dst += 16;
+			len -= 16;
+		}
+	}
+
+	if (dist >= 8) {
+		while (len >= 8) {
+			memcpy(dst, dst - dist, 8);
+			dst += 8;
+			len -= 8;
+		}
+	}
+
+	while (len > 0) {
+		*dst = *(dst - dist);
+		++dst;
+		--len;
+	}
+}
+
 /*
  * Repeat given number of bytes from the given distance. If the distance is
  * invalid, false is returned. On success, true is returned and *len is
@@ -346,7 +399,8 @@ static inline void dict_put(struct dictionary *dict, uint8_t byte)
 static bool dict_repeat(struct dictionary *dict, uint32_t *len, uint32_t dist)
 {
 	size_t back;
-	uint32_t left;
+	size_t left;
+	size_t copy;
 
 	if (dist >= dict->full || dist >= dict->size)
 		return false;
@@ -354,15 +408,25 @@ static bool dict_repeat(struct dictionary *dict, uint32_t *len, uint32_t dist)
 	left = min_t(size_t, dict->limit - dict->pos, *len);
 	*len -= left;
 
-	back = dict->pos - dist - 1;
-	if (dist >= dict->pos)
-		back += dict->end;
+	/*
+	 * If the match starts before the beginning of the circular buffer,
+	 * copy the part at the end of the buffer first. That is ahead of
+	 * dict->pos, so the copy goes from front to back like memmove().
+	 * The rest then starts at buf[0], dist + 1 bytes before dict->pos.
+	 */
+	if (dist >= dict->pos) {
+		back = dict->pos - dist - 1 + dict->end;
+		copy = min_t(size_t, dict->end - back, left);
 
-	do {
-		dict->buf[dict->pos++] = dict->buf[back++];
-		if (back == dict->end)
-			back = 0;
-	} while (--left > 0);
+		memmove(dict->buf + dict->pos, dict->buf + back, copy);
+		dict->pos += copy;
+		left -= copy;
+	}
+
+	if (left > 0) {
+		dict_copy(dict->buf + dict->pos, (size_t)dist + 1, left);
+		dict->pos += left;
+	}
 
 	if (dict->full < dict->pos)
 		dict->full = dict->pos;
@@ -370,7 +434,28 @@ static bool dict_repeat(struct dictionary *dict, uint32_t *len, uint32_t dist)
 	return true;
 }
 
-/* Copy uncompressed data as is from input to dictionary and output buffers. */
+/*
+ * Update the integrity check with data flushed from the dictionary. In
+ * multi-call mode, the data is copied and checked DICT_CHECK_CHUNK bytes at
+ * a time, so the check reads each chunk while it is still in the L1 cache.
+ */
+#define DICT_CHECK_CHUNK 4096
+
+static void dict_check(struct dictionary *dict, const uint8_t *buf,
+		       size_t size)
+{
+	if (dict->check_type == XZ_CHECK_CRC32)
+		*dict->crc = xz_crc32(buf, size, *dict->crc);
+#ifdef XZ_USE_CRC64
+	else if (dict->check_type == XZ_CHECK_CRC64)
+		*dict->crc = xz_crc64(buf, size, *dict->crc);
+#endif
+}
+
+/*
+ * Copy uncompressed data as is from input to dictionary and output buffers,
+ * updating the integrity check.
+ */
 static void dict_uncompressed(struct dictionary *dict, struct xz_buf *b,
 			      uint32_t *left)
 {
@@ -390,6 +475,9 @@ static void dict_uncompressed(struct dictionary *dict, struct xz_buf *b,
 		memcpy(dict->buf + dict->pos, b->in + b->in_pos, copy_size);
 		dict->pos += copy_size;
 
+		/* Not flushed through dict_flush(), so check it here */
+		dict_check(dict, b->in + b->in_pos, copy_size);
+
 		if (dict->full < dict->pos)
 			dict->full = dict->pos;
 
@@ -408,10 +496,31 @@ static void dict_uncompressed(struct dictionary *dict, struct xz_buf *b,
 	}
 }
 
+static void dict_copy_check(struct dictionary *dict, uint8_t *out,
+			    const uint8_t *in, size_t size)
+{
+	size_t chunk;
+
+	if (dict->check_type == XZ_CHECK_NONE) {
+		memcpy(out, in, size);
+		return;
+	}
+
+	while (size > 0) {
+		chunk = min_t(size_t, size, DICT_CHECK_CHUNK);
+		memcpy(out, in, chunk);
+		dict_check(dict, in, chunk);
+		out += chunk;
+		in += chunk;
+		size -= chunk;
+	}
+}
+
 /*
- * Flush pending data from dictionary to b->out. It is assumed that there is
- * enough space in b->out. This is guaranteed because caller uses dict_limit()
- * before decoding data into the dictionary.
+ * Flush pending data from dictionary to b->out, updating the integrity
+ * check on the way. It is assumed that there is enough space in b->out.
+ * This is guaranteed because caller uses dict_limit() before decoding data
+ * into the dictionary.
  */
 static uint32_t dict_flush(struct dictionary *dict, struct xz_buf *b)
 {
@@ -421,8 +530,11 @@ static uint32_t dict_flush(struct dictionary *dict, struct xz_buf *b)
 		if (dict->pos == dict->end)
 			dict->pos = 0;
 
-		memcpy(b->out + b->out_pos, dict->buf + dict->start,
-				copy_size);
+		dict_copy_check(dict, b->out + b->out_pos,
+				dict->buf + dict->start, copy_size);
+	} else {
+		/* The dictionary is b->out; the data was just decoded */
+		dict_check(dict, b->out + b->out_pos, copy_size);
 	}
 
 	dict->start = dict->pos;
@@ -515,6 +627,32 @@ static __always_inline int rc_bit(struct rc_dec *rc, uint16_t *prob)
 	return bit;
 }
 
+/*
+ * Decode one bit like rc_bit(), but without branching on it: mask is all
+ * ones if the bit is 1 and zero if it is 0, and selects between the two
+ * possible updates of range, code, and the probability. This is faster
+ * where the bit is just shifted into a symbol (in bittrees, whose bits are
+ * poorly predictable), but slower where the caller branches on it anyway.
+ */
+static __always_inline uint32_t rc_bit_nobranch(struct rc_dec *rc,
+						uint16_t *prob)
+{
+	uint32_t p = *prob;
+	uint32_t bound;
+	uint32_t mask;
+
+	rc_normalize(rc);
+	bound = (rc->range >> RC_BIT_MODEL_TOTAL_BITS) * p;
+	mask = (uint32_t)0 - (rc->code >= bound);
+
+	rc->range = (bound & ~mask) | ((rc->range - bound) & mask);
+	rc->code -= bound & mask;
+	*prob = (uint16_t)(p + (((RC_BIT_MODEL_TOTAL - p) >> RC_MOVE_BITS)
+				& ~mask) - ((p >> RC_MOVE_BITS) & mask));
+
+	return mask & 1;
+}
+
 /* Decode a bittree starting from the most significant bit. */
 static __always_inline uint32_t rc_bittree(struct rc_dec *rc,
 					   uint16_t *probs, uint32_t limit)
@@ -522,10 +660,7 @@ static __always_inline uint32_t rc_bittree(struct rc_dec *rc,
 	uint32_t symbol = 1;
 
 	do {
-		if (rc_bit(rc, &probs[symbol]))
-			symbol = (symbol << 1) + 1;
-		else
-			symbol <<= 1;
+		symbol = (symbol << 1) + rc_bit_nobranch(rc, &probs[symbol]);
 	} while (symbol < limit);
 
 	return symbol;
@@ -538,14 +673,12 @@ static __always_inline void rc_bittree_reverse(struct rc_dec *rc,
 {
 	uint32_t symbol = 1;
 	uint32_t i = 0;
+	uint32_t bit;
 
 	do {
-		if (rc_bit(rc, &probs[symbol])) {
-			symbol = (symbol << 1) + 1;
-			*dest += 1 << i;
-		} else {
-			symbol <<= 1;
-		}
+		bit = rc_bit_nobranch(rc, &probs[symbol]);
+		symbol = (symbol << 1) + bit;
+		*dest += bit << i;
 	} while (++i < limit);
 }
 
@@ -578,19 +711,21 @@ static uint16_t *lzma_literal_probs(struct xz_dec_lzma2 *s)
 }
 
 /* Decode a literal (one 8-bit byte) */
-static void lzma_literal(struct xz_dec_lzma2 *s)
+static __always_inline void lzma_literal(struct xz_dec_lzma2 *s,
+					  struct rc_dec *rc)
 {
 	uint16_t *probs;
 	uint32_t symbol;
 	uint32_t match_byte;
 	uint32_t match_bit;
 	uint32_t offset;
+	uint32_t bit;
 	uint32_t i;
 
 	probs = lzma_literal_probs(s);
 
 	if (lzma_state_is_literal(s->lzma.state)) {
-		symbol = rc_bittree(&s->rc, probs, 0x100);
+		symbol = rc_bittree(rc, probs, 0x100);
 	} else {
 		symbol = 1;
 		match_byte = dict_get(&s->dict, s->lzma.rep0) << 1;
@@ -601,13 +736,10 @@ static void lzma_literal(struct xz_dec_lzma2 *s)
 			match_byte <<= 1;
 			i = offset + match_bit + symbol;
 
-			if (rc_bit(&s->rc, &probs[i])) {
-				symbol = (symbol << 1) + 1;
-				offset &= match_bit;
-			} else {
-				symbol <<= 1;
-				offset &= ~match_bit;
-			}
+			/* offset &= bit ? match_bit : ~match_bit */
+			bit = rc_bit_nobranch(rc, &probs[i]);
+			symbol = (symbol << 1) + bit;
+			offset &= match_bit ^ (bit - 1);
 		} while (symbol < 0x100);
 	}
 
@@ -616,18 +748,20 @@ static void lzma_literal(struct xz_dec_lzma2 *s)
 }
 
 /* Decode the length of the match into s->lzma.len. */
-static void lzma_len(struct xz_dec_lzma2 *s, struct lzma_len_dec *l,
-		     uint32_t pos_state)
+static __always_inline void lzma_len(struct xz_dec_lzma2 *s,
+				      struct rc_dec *rc,
+				      struct lzma_len_dec *l,
+				      uint32_t pos_state)
 {
 	uint16_t *probs;
 	uint32_t limit;
 
-	if (!rc_bit(&s->rc, &l->choice)) {
+	if (!rc_bit(rc, &l->choice)) {
 		probs = l->low[pos_state];
 		limit = LEN_LOW_SYMBOLS;
 		s->lzma.len = MATCH_LEN_MIN;
 	} else {
-		if (!rc_bit(&s->rc, &l->choice2)) {
+		if (!rc_bit(rc, &l->choice2)) {
 			probs = l->mid[pos_state];
 			limit = LEN_MID_SYMBOLS;
 			s->lzma.len = MATCH_LEN_MIN + LEN_LOW_SYMBOLS;
@@ -639,11 +773,12 @@ static void lzma_len(struct xz_dec_lzma2 *s, struct lzma_len_dec *l,
 		}
 	}
 
-	s->lzma.len += rc_bittree(&s->rc, probs, limit) - limit;
+	s->lzma.len += rc_bittree(rc, probs, limit) - limit;
 }
 
 /* Decode a match. The distance will be stored in s->lzma.rep0. */
-static void lzma_match(struct xz_dec_lzma2 *s, uint32_t pos_state)
+static __always_inline void lzma_match(struct xz_dec_lzma2 *s,
+					struct rc_dec *rc, uint32_t pos_state)
 {
 	uint16_t *probs;
 	uint32_t dist_slot;
@@ -655,10 +790,10 @@ static void lzma_match(struct xz_dec_lzma2 *s, uint32_t pos_state)
 	s->lzma.rep2 = s->lzma.rep1;
 	s->lzma.rep1 = s->lzma.rep0;
 
-	lzma_len(s, &s->lzma.match_len_dec, pos_state);
+	lzma_len(s, rc, &s->lzma.match_len_dec, pos_state);
 
 	probs = s->lzma.dist_slot[lzma_get_dist_state(s->lzma.len)];
-	dist_slot = rc_bittree(&s->rc, probs, DIST_SLOTS) - DIST_SLOTS;
+	dist_slot = rc_bittree(rc, probs, DIST_SLOTS) - DIST_SLOTS;
 
 	if (dist_slot < DIST_MODEL_START) {
 		s->lzma.rep0 = dist_slot;
@@ -670,12 +805,12 @@ static void lzma_match(struct xz_dec_lzma2 *s, uint32_t pos_state)
 			s->lzma.rep0 <<= limit;
 			probs = s->lzma.dist_special + s->lzma.rep0
 					- dist_slot - 1;
-			rc_bittree_reverse(&s->rc, probs,
+			rc_bittree_reverse(rc, probs,
 					&s->lzma.rep0, limit);
 		} else {
-			rc_direct(&s->rc, &s->lzma.rep0, limit - ALIGN_BITS);
+			rc_direct(rc, &s->lzma.rep0, limit - ALIGN_BITS);
 			s->lzma.rep0 <<= ALIGN_BITS;
-			rc_bittree_reverse(&s->rc, s->lzma.dist_align,
+			rc_bittree_reverse(rc, s->lzma.dist_align,
 					&s->lzma.rep0, ALIGN_BITS);
 		}
 	}
@@ -685,22 +820,24 @@ static void lzma_match(struct xz_dec_lzma2 *s, uint32_t pos_state)
  * Decode a repeated match. The distance is one of the four most recently
  * seen matches. The distance will be stored in s->lzma.rep0.
  */
-static void lzma_rep_match(struct xz_dec_lzma2 *s, uint32_t pos_state)
+static __always_inline void lzma_rep_match(struct xz_dec_lzma2 *s,
+					    struct rc_dec *rc,
+					    uint32_t pos_state)
 {
 	uint32_t tmp;
 
-	if (!rc_bit(&s->rc, &s->lzma.is_rep0[s->lzma.state])) {
-		if (!rc_bit(&s->rc, &s->lzma.is_rep0_long[
+	if (!rc_bit(rc, &s->lzma.is_rep0[s->lzma.state])) {
+		if (!rc_bit(rc, &s->lzma.is_rep0_long[
 				s->lzma.state][pos_state])) {
 			lzma_state_short_rep(&s->lzma.state);
 			s->lzma.len = 1;
 			return;
 		}
 	} else {
-		if (!rc_bit(&s->rc, &s->lzma.is_rep1[s->lzma.state])) {
+		if (!rc_bit(rc, &s->lzma.is_rep1[s->lzma.state])) {
 			tmp = s->lzma.rep1;
 		} else {
-			if (!rc_bit(&s->rc, &s->lzma.is_rep2[s->lzma.state])) {
+			if (!rc_bit(rc, &s->lzma.is_rep2[s->lzma.state])) {
 				tmp = s->lzma.rep2;
 			} else {
 				tmp = s->lzma.rep3;
@@ -715,13 +852,26 @@ static void lzma_rep_match(struct xz_dec_lzma2 *s, uint32_t pos_state)
 	}
 
 	lzma_state_long_rep(&s->lzma.state);
-	lzma_len(s, &s->lzma.rep_len_dec, pos_state);
+	lzma_len(s, rc, &s->lzma.rep_len_dec, pos_state);
 }
 
-/* LZMA decoder core */
+/*
+ * LZMA decoder core
+ *
+ * The range decoder state is copied into a local variable for the duration
+ * of the loop, and the functions above are all inlined here, so that the
+ * compiler can keep range, code, and the input position in registers. (In
+ * s->rc, they would have to be reloaded after every write to the dictionary,
+ * since a byte store may alias anything.) The caller guarantees that there
+ * are LZMA_IN_REQUIRED bytes of input past in_limit, so the loop doesn't
+ * need to check for the end of input while decoding a symbol; near the end
+ * of the input, lzma2_lzma() decodes from s->temp.buf instead.
+ */
 static bool lzma_main(struct xz_dec_lzma2 *s)
 {
+	struct rc_dec rc = s->rc;
 	uint32_t pos_state;
+	bool ret = true;
 
 	/*
 	 * If the dictionary was reached during the previous call, try to
@@ -734,20 +884,23 @@ static bool lzma_main(struct xz_dec_lzma2 *s)
 	 * Decode more LZMA symbols. One iteration may consume up to
 	 * LZMA_IN_REQUIRED - 1 bytes.
 	 */
-	while (dict_has_space(&s->dict) && !rc_limit_exceeded(&s->rc)) {
+	while (dict_has_space(&s->dict) && !rc_limit_exceeded(&rc)) {
 		pos_state = s->dict.pos & s->lzma.pos_mask;
 
-		if (!rc_bit(&s->rc, &s->lzma.is_match[
+		if (!rc_bit(&rc, &s->lzma.is_match[
 				s->lzma.state][pos_state])) {
-			lzma_literal(s);
+			lzma_literal(s, &rc);
 		} else {
-			if (rc_bit(&s->rc, &s->lzma.is_rep[s->lzma.state]))
-				lzma_rep_match(s, pos_state);
+			if (rc_bit(&rc, &s->lzma.is_rep[s->lzma.state]))
+				lzma_rep_match(s, &rc, pos_state);
 			else
-				lzma_match(s, pos_state);
+				lzma_match(s, &rc, pos_state);
 
-			if (!dict_repeat(&s->dict, &s->lzma.len, s->lzma.rep0))
-				return false;
+			if (!dict_repeat(&s->dict, &s->lzma.len,
+					 s->lzma.rep0)) {
+				ret = false;
+				break;
+			}
 		}
 	}
 
@@ -755,9 +908,10 @@ static bool lzma_main(struct xz_dec_lzma2 *s)
 	 * Having the range decoder always normalized when we are outside
 	 * this function makes it easier to correctly handle end of the chunk.
 	 */
-	rc_normalize(&s->rc);
+	rc_normalize(&rc);
 
-	return true;
+	s->rc = rc;
+	return ret;
 }
 
 /*
@@ -1114,6 +1268,8 @@ XZ_EXTERN struct xz_dec_lzma2 *xz_dec_lzma2_create(enum xz_mode mode,
 
 	s->dict.mode = mode;
 	s->dict.size_max = dict_max;
+	s->dict.check_type = XZ_CHECK_NONE;
+	s->dict.crc = NULL;
 
 	if (DEC_IS_PREALLOC(mode)) {
 		s->dict.buf = vmalloc(dict_max);
@@ -1166,6 +1322,13 @@ XZ_EXTERN enum xz_ret xz_dec_lzma2_reset(struct xz_dec_lzma2 *s, uint8_t props)
 	return XZ_OK;
 }
 
+XZ_EXTERN void xz_dec_lzma2_check(struct xz_dec_lzma2 *s,
+				  enum xz_check check_type, xz_crc_t *crc)
+{
+	s->dict.check_type = check_type;
+	s->dict.crc = crc;
+}
+
 XZ_EXTERN void xz_dec_lzma2_end(struct xz_dec_lzma2 *s)
 {
 	if (DEC_IS_MULTI(s->dict.mode))
@@ -48,13 +48,8 @@ struct xz_dec {
 	size_t in_start;
 	size_t out_start;
 
-#ifdef XZ_USE_CRC64
 	/* CRC32 or CRC64 value in Block or CRC32 value in Index */
-	uint64_t crc;
-#else
-	/* CRC32 value in Block or Index */
-	uint32_t crc;
-#endif
+	xz_crc_t crc;
 
 	/* Type of the integrity check calculated from uncompressed data */
 	enum xz_check check_type;
@@ -252,15 +247,6 @@ static enum xz_ret dec_block(struct xz_dec *s, struct xz_buf *b)
 				> s->block_header.uncompressed)
 		return XZ_DATA_ERROR;
 
-	if (s->check_type == XZ_CHECK_CRC32)
-		s->crc = xz_crc32(b->out + s->out_start,
-				b->out_pos - s->out_start, s->crc);
-#ifdef XZ_USE_CRC64
-	else if (s->check_type == XZ_CHECK_CRC64)
-		s->crc = xz_crc64(b->out + s->out_start,
-				b->out_pos - s->out_start, s->crc);
-#endif
-
 	if (ret == XZ_STREAM_END) {
 		if (s->block_header.compressed != VLI_UNKNOWN
 				&& s->block_header.compressed
@@ -555,6 +541,18 @@ static enum xz_ret dec_block_header(struct xz_dec *s)
 	if (ret != XZ_OK)
 		return ret;
 
+	/*
+	 * The check is updated as the output is written: by the BCJ filter,
+	 * if there is one, as it changes what the LZMA2 decoder wrote.
+	 */
+#ifdef XZ_DEC_BCJ
+	if (s->bcj_active) {
+		xz_dec_lzma2_check(s->lzma2, XZ_CHECK_NONE, NULL);
+		xz_dec_bcj_check(s->bcj, s->check_type, &s->crc);
+	} else
+#endif
+		xz_dec_lzma2_check(s->lzma2, s->check_type, &s->crc);
+
 	/* The rest must be Header Padding. */
 	while (s->temp.pos < s->temp.size)
 		if (s->temp.buf[s->temp.pos++] != 0x00)
@@ -50,6 +50,9 @@
 #	include "xz_config.h"
 #endif
 
+/* Integrity Check types, for xz_dec_lzma2_check() */
+#include "xz_stream.h"
+
 /* If no specific decoding mode is requested, enable support for all modes. */
 #if !defined(XZ_DEC_SINGLE) && !defined(XZ_DEC_PREALLOC) \
 		&& !defined(XZ_DEC_DYNALLOC)
@@ -125,6 +128,15 @@ XZ_EXTERN enum xz_ret xz_dec_lzma2_run(struct xz_dec_lzma2 *s,
 /* Free the memory allocated for the LZMA2 decoder. */
 XZ_EXTERN void xz_dec_lzma2_end(struct xz_dec_lzma2 *s);
 
+/*
+ * Make xz_dec_lzma2_run() update *crc with the CRC32 or CRC64 (check_type)
+ * of its output as it copies it out of the dictionary, rather than the
+ * caller having to read the output again. With any other check_type,
+ * nothing is calculated.
+ */
+XZ_EXTERN void xz_dec_lzma2_check(struct xz_dec_lzma2 *s,
+				  enum xz_check check_type, xz_crc_t *crc);
+
 #ifdef XZ_DEC_BCJ
 /*
  * Allocate memory for BCJ decoders. xz_dec_bcj_reset() must be used before
@@ -140,6 +152,14 @@ XZ_EXTERN struct xz_dec_bcj *xz_dec_bcj_create(bool single_call);
  */
 XZ_EXTERN enum xz_ret xz_dec_bcj_reset(struct xz_dec_bcj *s, uint8_t id);
 
+/*
+ * Make xz_dec_bcj_run() update *crc with the CRC32 or CRC64 (check_type) of
+ * its output as it is filtered, like xz_dec_lzma2_check(). The LZMA2 decoder
+ * under it must then calculate nothing, as the filter changes its output.
+ */
+XZ_EXTERN void xz_dec_bcj_check(struct xz_dec_bcj *s,
+				enum xz_check check_type, xz_crc_t *crc);
+
 /*
  * Decode raw BCJ + LZMA2 stream. This must be used only if there actually is
  * a BCJ filter in the chain. If the chain has only LZMA2, xz_dec_lzma2_run()
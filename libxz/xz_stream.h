@@ -56,6 +56,13 @@ enum xz_check {
 	XZ_CHECK_SHA256 = 10
 };
 
+/* CRC32 or CRC64 value of the integrity check of a Block */
+#ifdef XZ_USE_CRC64
+typedef uint64_t xz_crc_t;
+#else
+typedef uint32_t xz_crc_t;
+#endif
+
 /* Maximum possible Check ID */
 #define XZ_CHECK_MAX 15
 
@@ -23,6 +23,22 @@ def parse_args():
             help = 'Strip binaries before adding to archive (reduces size)')
     ap.add_argument('--no-compress', action='store_true',
             help = "Don't compress the archive (increases size)")
+    ap.add_argument('--cache', action='store_true',
+            help = "Extract once into a per-user cache, and re-use it on later runs")
+    ap.add_argument('--memfd', action='store_true',
+            help = "Extract files into memory (memfd) rather than to disk; they "
+                   "remain available until the program exits, but not to other users")
+    ap.add_argument('--exec', action='store_true',
+            help = "Replace the bootloader with the program, rather than running it in a child process")
+    ap.add_argument('--ldso', action='store_true',
+            help = "Launch the program via the bundled ld.so instead of patching it")
+    ap.add_argument('--tmpfs', action='store_true',
+            help = "Extract into a private tmpfs, in a new user and mount namespace")
+    ap.add_argument('--tmpdir', metavar='DIR',
+            help = "Extract under DIR, or with 'auto', the first suitable tmpfs "
+                   "(default: $TMPDIR or /tmp, at runtime)")
+    ap.add_argument('--share-libs', action='store_true',
+            help = "Extract libraries once into a per-user store shared by all bundles")
 
     # Special / output-related options
     ap.add_argument('-V', '--version', action='version',
@@ -46,6 +62,13 @@ def main():
                 bootloader = args.bootloader,
                 strip = args.strip,
                 compress = not args.no_compress,
+                cache = args.cache,
+                memfd = args.memfd,
+                exec_in_place = args.exec,
+                ldso = args.ldso,
+                tmpfs = args.tmpfs,
+                extract_root = args.tmpdir,
+                share_libs = args.share_libs,
                 )
     except Error as e:
         print("staticx: " + str(e))
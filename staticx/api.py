@@ -5,6 +5,7 @@
 import shutil
 from tempfile import NamedTemporaryFile, mkdtemp
 import os
+import hashlib
 from os.path import basename
 import logging
 from itertools import chain
@@ -48,8 +49,41 @@ def generate_archive(prog, interp, tmpdir, extra_libs=None, strip=False, compres
         run_hooks(ar, prog)
 
     f.flush()
+
+    idx = NamedTemporaryFile(prefix='staticx-index-')
+    ar.write_index(idx)
+    idx.flush()
+
+    return f, idx
+
+def _bundle_digest(paths, options):
+    """Compute a SHA-256 hex digest identifying a bundle
+
+    This covers the contents of the given files, and the bootloader options.
+    """
+    h = hashlib.sha256()
+    for path in paths:
+        with open(path, 'rb') as f:
+            for chunk in iter(lambda: f.read(1 << 20), b''):
+                h.update(chunk)
+    h.update(repr(sorted(options.items())).encode('utf-8'))
+    return h.hexdigest()
+
+
+def generate_config(options):
+    """Generate the contents of the bootloader config section
+
+    Each option is stored as a key=value line.
+    """
+    f = NamedTemporaryFile(prefix='staticx-config-', mode='w')
+    for key, value in sorted(options.items()):
+        if isinstance(value, bool):
+            value = int(value)
+        f.write('{}={}\n'.format(key, value))
+    f.flush()
     return f
 
+
 def _locate_bootloader():
     """Determine path to bootloader"""
     pkg_path = os.path.dirname(__file__)
@@ -78,7 +112,9 @@ def _copy_to_tempfile(srcpath, **kwargs):
     return fdst
 
 
-def generate(prog, output, libs=None, bootloader=None, strip=False, compress=True):
+def generate(prog, output, libs=None, bootloader=None, strip=False, compress=True,
+             cache=False, memfd=False, exec_in_place=False, ldso=False,
+             tmpfs=False, extract_root=None, share_libs=False):
     """Main API: Generate a staticx executable
 
     Parameters:
@@ -87,7 +123,22 @@ def generate(prog, output, libs=None, bootloader=None, strip=False, compress=Tru
     libs: Extra libraries to include
     bootloader: Override the bootloader binary
     strip: Strip binaries to reduce size
+    cache: Extract once into a persistent cache, and re-use it on later runs
+    memfd: Extract files into memory (memfd) rather than to disk
+    exec_in_place: Replace the bootloader with the program (keeping its PID),
+                   rather than running it in a child process
+    ldso: Launch the program by running the bundled ld.so, and store it
+          unmodified rather than patching it
+    tmpfs: Extract into a private tmpfs, in a new user and mount namespace,
+           which the kernel discards when the program exits
+    extract_root: Directory under which to extract, or 'auto' to pick the first
+            suitable tmpfs at runtime (default: $TMPDIR or /tmp)
+    share_libs: Extract each library once into a per-user store, shared by all
+                bundles, and link to it rather than extracting a copy each run
     """
+    if extract_root and extract_root != 'auto' and not os.path.isabs(extract_root):
+        raise InvalidInputError("Extraction directory must be an absolute path, or 'auto'")
+
     if not bootloader:
         bootloader = _locate_bootloader()
     _check_bootloader_compat(bootloader, prog)
@@ -109,10 +160,11 @@ def generate(prog, output, libs=None, bootloader=None, strip=False, compress=Tru
 
         # Set long dummy INTERP and RPATH in the executable to allow plenty of space
         # for bootloader to patch them at runtime, without the reording complexity
-        # that patchelf has to do.
-        new_interp = 'i' * MAX_INTERP_LEN
-        new_rpath = 'r' * MAX_RPATH_LEN
-        patch_elf(tmpprog, interpreter=new_interp, rpath=new_rpath, force_rpath=True)
+        # that patchelf has to do. When launched via ld.so, neither is used.
+        if not ldso:
+            new_interp = 'i' * MAX_INTERP_LEN
+            new_rpath = 'r' * MAX_RPATH_LEN
+            patch_elf(tmpprog, interpreter=new_interp, rpath=new_rpath, force_rpath=True)
 
         # Work on a temp copy of the bootloader
         tmpoutput = _copy_to_tempfile(bootloader, prefix='staticx-output-', delete=False).name
@@ -121,9 +173,29 @@ def generate(prog, output, libs=None, bootloader=None, strip=False, compress=Tru
             logging.info("Stripping bootloader {}".format(tmpoutput))
             strip_elf(tmpoutput)
 
-        # Starting from the bootloader, append archive
-        with generate_archive(tmpprog, orig_interp, tmpdir, libs, strip=strip, compress=compress) as ar:
+        options = dict(
+            cache = cache,
+            memfd = memfd,
+            exec = exec_in_place,
+            ldso = ldso,
+            tmpfs = tmpfs,
+            share_libs = share_libs,
+        )
+        if extract_root:
+            options['tmpdir'] = extract_root
+
+        # Starting from the bootloader, append archive and its index
+        ar, idx = generate_archive(tmpprog, orig_interp, tmpdir, libs, strip=strip, compress=compress)
+        with ar, idx:
+            # The digest identifies this bundle's extraction cache directory,
+            # so it covers everything which affects the extracted files.
+            options['digest'] = _bundle_digest([tmpoutput, ar.name, idx.name], options)
+
             elf_add_section(tmpoutput, ARCHIVE_SECTION, ar.name)
+            elf_add_section(tmpoutput, INDEX_SECTION, idx.name)
+
+        with generate_config(options) as cfg:
+            elf_add_section(tmpoutput, CONFIG_SECTION, cfg.name)
 
         # Move the temporary output file to its final place
         move_file(tmpoutput, output)
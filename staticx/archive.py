@@ -1,6 +1,9 @@
 import tarfile
+import hashlib
 import logging
-from os.path import basename, islink
+import struct
+import zlib
+from os.path import basename, getsize, islink
 
 try:
     # Python >= 3.3
@@ -41,27 +44,162 @@ def get_xz_filters():
     filters.append(dict(id=lzma.FILTER_LZMA2))
     return filters
 
+# Amount of uncompressed data in each XZ stream
+XZ_STREAM_SIZE = 4 << 20    # 4 MiB
+
+
+class XZMultiStreamWriter(object):
+    """File-like object which compresses data into a series of XZ streams
+
+    Each stream holds (at most) stream_size bytes of the input, and is
+    independent of the others, so the bootloader can decompress them in
+    parallel. The concatenated streams are still a valid .xz file.
+    """
+    def __init__(self, fileobj, stream_size, **kwargs):
+        self.fileobj = fileobj
+        self.stream_size = stream_size
+        self.kwargs = kwargs
+
+        self._comp = None
+        self._stream_pos = 0
+        self._pos = 0
+        self._out_pos = 0
+
+    def _output(self, data):
+        self.fileobj.write(data)
+        self._out_pos += len(data)
+
+    def end_stream(self):
+        """End the current stream, so following data starts a new one"""
+        if self._comp:
+            self._output(self._comp.flush())
+            self._comp = None
+
+    def write(self, data):
+        while data:
+            if self._comp is None:
+                self._comp = lzma.LZMACompressor(**self.kwargs)
+                self._stream_pos = 0
+
+            n = min(len(data), self.stream_size - self._stream_pos)
+            self._output(self._comp.compress(data[:n]))
+            self._stream_pos += n
+            self._pos += n
+            data = data[n:]
+
+            if self._stream_pos == self.stream_size:
+                self.end_stream()
+
+    def tell(self):
+        return self._pos
+
+    def out_tell(self):
+        """Get the number of compressed bytes written"""
+        return self._out_pos
+
+    def close(self):
+        self.end_stream()
+
+
+class ChecksumWriter(object):
+    """Pass-through file-like object which computes the CRC32 of its data"""
+    def __init__(self, fileobj):
+        self.fileobj = fileobj
+        self.crc = 0
+        self._pos = fileobj.tell()
+
+    def write(self, data):
+        self.crc = zlib.crc32(data, self.crc) & 0xFFFFFFFF
+        self.fileobj.write(data)
+        self._pos += len(data)
+
+    def tell(self):
+        return self._pos
+
+
+class IndexEntry(object):
+    """Location of one member in the archive
+
+    offset and csize locate the member's (possibly compressed) data in the
+    archive; usize and crc describe the tar data it holds: the member's
+    header(s) and contents, including padding. digest and size, if given, are
+    the SHA-256 and size of the contents of the (single, regular) file it
+    holds.
+    """
+    def __init__(self, name, offset, csize, usize, crc, flags, digest=None,
+                 size=None):
+        self.name = name
+        self.offset = offset
+        self.csize = csize
+        self.usize = usize
+        self.crc = crc
+        self.flags = flags
+        self.digest = digest
+        self.size = size
+
+
+# Index section layout (all integers little-endian):
+#   Header: magic, number of entries
+#   Entry:  offset, csize, usize, crc32, flags, name length,
+#           name (not terminated),
+#           SHA-256 of the file's contents (only with INDEX_FLAG_DIGEST),
+#           size of the file (only with INDEX_FLAG_SIZE)
+INDEX_MAGIC = b'SXIX'
+INDEX_HEADER = struct.Struct('<4sI')
+INDEX_ENTRY = struct.Struct('<QQQIHH')
+INDEX_SIZE = struct.Struct('<Q')
+
+# Index entry flags
+INDEX_FLAG_DIGEST   = 0x2   # Entry is followed by a digest
+INDEX_FLAG_SIZE     = 0x4   # Entry is followed by the size of its file
+
+
+def file_digest(path):
+    """Compute the SHA-256 digest of a file's contents"""
+    h = hashlib.sha256()
+    with open(path, 'rb') as f:
+        for chunk in iter(lambda: f.read(1 << 20), b''):
+            h.update(chunk)
+    return h.digest()
+
+
 class SxArchive(object):
+    """A staticx archive
+
+    The archive is a tar file, in which each member is stored as its own
+    unit: when compressed, no XZ stream spans two members. Together with the
+    index (see write_index()), this allows the bootloader to extract any
+    member without decompressing the others.
+    """
     def __init__(self, fileobj, mode, compress):
+        if mode != 'w':
+            raise ValueError("Archives can only be written")
+
+        self.fileobj = fileobj
         self.xzf = None
 
         if compress:
-            self.xzf = lzma.open(
-                filename = fileobj,
-                mode = mode,
+            self.xzf = XZMultiStreamWriter(
+                fileobj = fileobj,
+                stream_size = XZ_STREAM_SIZE,
                 format = lzma.FORMAT_XZ,
 
-                # Use CRC32 instead of CRC64 (FORMAT_XZ default)
-                # Otherwise, enable XZ_USE_CRC64 in libxz/xz_config.h
-                check = lzma.CHECK_CRC32,
+                # The FORMAT_XZ default; the bootloader is built with
+                # XZ_USE_CRC64 (see SConstruct)
+                check = lzma.CHECK_CRC64,
 
                 filters = get_xz_filters(),
             )
 
             fileobj = self.xzf
 
-        self.tar = tarfile.open(fileobj=fileobj, mode=mode)
+        self.csum = ChecksumWriter(fileobj)
+        # GNU format, rather than the default pax, which (in Python 3) adds a
+        # pax header to every member, for its sub-second mtime
+        self.tar = tarfile.open(fileobj=self.csum, mode=mode,
+                                format=tarfile.GNU_FORMAT)
         self._added_libs = []
+        self._index = []
 
     def __enter__(self):
         return self
@@ -71,6 +209,55 @@ class SxArchive(object):
         if self.xzf:
             self.xzf.close()
 
+    def _stored_pos(self):
+        """Get the current position in the stored (compressed) archive"""
+        if self.xzf:
+            return self.xzf.out_tell()
+        return self.fileobj.tell()
+
+    def _add_member(self, name, add, digest=None, size=None):
+        """Call add() to add a member, recording it in the index"""
+        flags = 0
+        if digest:
+            flags |= INDEX_FLAG_DIGEST
+        if size is not None:
+            flags |= INDEX_FLAG_SIZE
+
+        if self.xzf:
+            self.xzf.end_stream()
+
+        offset = self._stored_pos()
+        start = self.tar.offset
+        self.csum.crc = 0
+
+        add()
+
+        if self.xzf:
+            self.xzf.end_stream()
+
+        self._index.append(IndexEntry(
+            name = name,
+            offset = offset,
+            csize = self._stored_pos() - offset,
+            usize = self.tar.offset - start,
+            crc = self.csum.crc,
+            flags = flags,
+            digest = digest,
+            size = size,
+        ))
+
+    def write_index(self, f):
+        """Write the archive index to a file"""
+        f.write(INDEX_HEADER.pack(INDEX_MAGIC, len(self._index)))
+        for ent in self._index:
+            name = ent.name.encode('utf-8')
+            f.write(INDEX_ENTRY.pack(ent.offset, ent.csize, ent.usize,
+                                     ent.crc, ent.flags, len(name)))
+            f.write(name)
+            if ent.digest:
+                f.write(ent.digest)
+            if ent.size is not None:
+                f.write(INDEX_SIZE.pack(ent.size))
 
     @property
     def libraries(self):
@@ -83,7 +270,7 @@ class SxArchive(object):
         t.name = name
         t.linkname = target
 
-        self.tar.addfile(t)
+        self._add_member(name, lambda: self.tar.addfile(t))
 
     def add_program(self, path):
         """Add user program to the archive
@@ -93,15 +280,18 @@ class SxArchive(object):
         """
         arcname = PROG_FILENAME
         logging.info("Adding {} as {}".format(path, arcname))
-        self.tar.add(path, arcname=arcname)
+        self._add_member(arcname, lambda: self.tar.add(path, arcname=arcname),
+                         size=getsize(path))
 
     def add_library(self, path):
         """Add a library to the archive
 
         The library will be added with its base name.
         Symlinks will also be added and followed.
-        """
 
+        The digest of each library is recorded in the index, so the bootloader
+        can share one extracted copy between bundles (see "share_libs").
+        """
         if basename(path) in self._added_libs:
             raise LibExistsError(basename(path))
 
@@ -119,7 +309,8 @@ class SxArchive(object):
         # left with a real file at this point, add it to the archive.
         arcname = basename(linklib)
         logging.info("    Adding {} as {}".format(linklib, arcname))
-        self.tar.add(linklib, arcname=arcname)
+        self._add_member(arcname, lambda: self.tar.add(linklib, arcname=arcname),
+                         digest=file_digest(linklib), size=getsize(linklib))
         self._added_libs.append(arcname)
 
     def add_interp_symlink(self, interp):
@@ -1,4 +1,6 @@
 ARCHIVE_SECTION = ".staticx.archive"
+CONFIG_SECTION  = ".staticx.config"
+INDEX_SECTION   = ".staticx.index"
 INTERP_FILENAME = ".staticx.interp"
 PROG_FILENAME   = ".staticx.prog"
 
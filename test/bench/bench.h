@@ -0,0 +1,55 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+static inline double
+now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Best time in seconds of runs evaluations of expr */
+#define TIME_BEST(runs, expr) ({                        \
+    double _best = 0;                                   \
+    for (int _i = 0; _i < (runs); _i++) {               \
+        double _start = now();                          \
+        (void)(expr);                                   \
+        double _t = now() - _start;                     \
+        if (_i == 0 || _t < _best)                      \
+            _best = _t;                                 \
+    }                                                   \
+    _best;                                              \
+})
+
+static inline void *
+read_file(const char *path, size_t *size)
+{
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        perror(path);
+        exit(2);
+    }
+
+    size_t cap = 1 << 16, len = 0, n;
+    char *buf = malloc(cap);
+    while (buf && (n = fread(buf + len, 1, cap - len, f)) > 0) {
+        len += n;
+        if (len == cap)
+            buf = realloc(buf, cap *= 2);
+    }
+    if (!buf) {
+        fprintf(stderr, "Out of memory\n");
+        exit(2);
+    }
+    fclose(f);
+
+    *size = len;
+    return buf;
+}
+
+#endif /* BENCH_H */
@@ -0,0 +1,104 @@
+"""Write the inputs for the benchmarks
+
+Usage: make_inputs.py DIR
+
+Prints the name of each input written to DIR. For each .xz file, the size
+it decodes to follows its name.
+"""
+from __future__ import print_function
+import io
+import os
+import random
+import sys
+import tarfile
+
+try:
+    import lzma
+except ImportError:
+    from backports import lzma
+
+# As the builder compresses bundles for x86-64
+XZ_FILTERS = [
+    dict(id=lzma.FILTER_X86),
+    dict(id=lzma.FILTER_LZMA2, preset=9),
+]
+
+
+def many_members(path):
+    """A tar archive of many small files, like a bundle of shared libraries"""
+    rand = random.Random(42)
+    with tarfile.open(path, 'w', format=tarfile.GNU_FORMAT) as tar:
+        for i in range(2000):
+            data = bytes(bytearray(rand.getrandbits(8)
+                                   for _ in range(rand.randrange(4096))))
+            info = tarfile.TarInfo('lib/libbench{}.so.{}'.format(i, i % 7))
+            info.size = len(data)
+            info.mode = 0o755
+            tar.addfile(info, io.BytesIO(data))
+
+            link = tarfile.TarInfo('lib/libbench{}.so'.format(i))
+            link.type = tarfile.SYMTYPE
+            link.linkname = os.path.basename(info.name)
+            tar.addfile(link)
+
+
+def shared_libs():
+    """Up to 16 MB of this system's shared libraries: what bundles carry"""
+    limit = 16 << 20
+    data = b''
+    for dirpath, dirnames, filenames in os.walk('/usr/lib'):
+        dirnames.sort()
+        for name in sorted(filenames):
+            path = os.path.join(dirpath, name)
+            if '.so' not in name or os.path.islink(path) or len(data) >= limit:
+                continue
+            with open(path, 'rb') as f:
+                data += f.read(limit - len(data))
+    return data
+
+
+def repeats():
+    """32 MB of long matches: zero runs, and short and long periods"""
+    rand = random.Random(42)
+    pieces = []
+    size = 0
+    while size < 32 << 20:
+        kind = rand.randrange(3)
+        length = rand.randrange(1, 64 << 10)
+        if kind == 0:
+            piece = b'\0' * length
+        else:
+            period = rand.randrange(1, 8) if kind == 1 else rand.randrange(8, 4096)
+            unit = bytes(bytearray(rand.getrandbits(8) for _ in range(period)))
+            piece = (unit * (length // period + 1))[:length]
+        pieces.append(piece)
+        size += length
+    return b''.join(pieces)
+
+
+def xz_file(make):
+    def write(path):
+        data = make()
+        with open(path, 'wb') as f:
+            f.write(lzma.compress(data, format=lzma.FORMAT_XZ,
+                                  check=lzma.CHECK_CRC64, filters=XZ_FILTERS))
+        return len(data)
+    return write
+
+
+INPUTS = [
+    ('many.tar', many_members),
+    ('libs.xz', xz_file(shared_libs)),
+    ('repeats.xz', xz_file(repeats)),
+]
+
+
+def main():
+    outdir = sys.argv[1]
+    for name, make in INPUTS:
+        size = make(os.path.join(outdir, name))
+        print(name if size is None else '{} {}'.format(name, size))
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,76 @@
+#!/bin/bash
+set -e
+
+# Benchmark parts of the bootloader on generated inputs. These only print
+# timings; to compare two versions, run this in a checkout of each.
+#
+# Usage: run_bench.sh [RUNS]
+
+echo -e "\n\nBenchmark the bootloader"
+
+cd "$(dirname "${BASH_SOURCE[0]}")"
+bootloader=../../bootloader
+libtar=../../libtar
+libxz=../../libxz
+
+runs=${1:-20}
+
+workdir=$(mktemp -d)
+trap "rm -rf $workdir" EXIT
+
+python make_inputs.py $workdir > $workdir/inputs
+
+# libtar, with its SConscript's sources and defines
+mkdir $workdir/libtar
+for src in $(sed -n "s/^ *'\(.*\.c\)',$/\1/p" $libtar/SConscript); do
+    ${CC:-cc} -std=gnu99 -O2 -I$libtar -I$libtar/compat \
+        -DPACKAGE_VERSION='"1.2.20"' -c $libtar/$src \
+        -o $workdir/libtar/$(basename $src .c).o
+done
+ar rcs $workdir/libtar.a $workdir/libtar/*.o
+
+# The in-place tar reader against libtar
+${CC:-cc} -std=gnu99 -O2 -Wall -Werror -I$bootloader -I$libtar \
+    -o $workdir/tar_bench tar_bench.c $bootloader/tarview.c $workdir/libtar.a
+
+echo -e "\nListing an archive:"
+$workdir/tar_bench $workdir/many.tar $runs
+
+# The xz decoder, built as libxz's SConscript does on x86-64
+${CC:-cc} -std=gnu99 -O2 -Wall -Werror -DXZ_USE_CRC64=1 -DXZ_DEC_X86=1 \
+    -I$libxz -o $workdir/xz_bench xz_bench.c \
+    $libxz/xz_crc32.c $libxz/xz_crc64.c $libxz/xz_dec_lzma2.c \
+    $libxz/xz_dec_stream.c $libxz/xz_dec_bcj.c
+
+echo -e "\nDecoding:"
+grep '\.xz ' $workdir/inputs | while read name size; do
+    $workdir/xz_bench $workdir/$name $size $runs
+done
+
+# Extraction with and without io_uring, through a bundle (made by the
+# installed staticx) of a program and many small libraries
+if ! which staticx > /dev/null; then
+    echo -e "\nstaticx not found; not timing extraction"
+    exit 0
+fi
+
+mkdir $workdir/libs
+echo 'const char data[16384] = "bench";' > $workdir/lib.c
+for i in $(seq 300); do
+    ${CC:-cc} -shared -fPIC -o $workdir/libs/libbench$i.so $workdir/lib.c
+done
+staticx --no-compress $(printf -- '-l %s ' $workdir/libs/*.so) \
+    $(which true) $workdir/true.staticx > /dev/null
+
+# Best wall time in ms of $runs runs of the bundle, with STATICX_IO_URING=$1
+time_bundle() {
+    for i in $(seq $runs); do
+        start=$(date +%s%N)
+        STATICX_IO_URING=$1 $workdir/true.staticx > /dev/null
+        echo $(( ($(date +%s%N) - start) / 1000 ))
+    done | sort -n | head -1 | awk '{ printf "%.1f ms\n", $1 / 1000 }'
+}
+
+echo -e "\nExtracting 300 libraries:"
+echo "  io_uring off $(time_bundle 0)"
+echo "  io_uring on  $(time_bundle 1)"
@@ -0,0 +1,115 @@
+/**
+ * Time listing an uncompressed tar archive held in memory, with libtar (as
+ * the bootloader used to) and with the bootloader's tarview.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <libtar.h>
+#include "tarview.h"
+#include "bench.h"
+
+static const char *m_buf;
+static size_t m_size;
+static size_t m_pos;
+
+static int mem_open(const char *pathname, int flags, ...)
+{
+    m_pos = 0;
+    return 0;
+}
+
+static int mem_close(int fd)
+{
+    return 0;
+}
+
+static ssize_t mem_read(int fd, void *buf, size_t len)
+{
+    if (len > m_size - m_pos)
+        len = m_size - m_pos;
+    memcpy(buf, m_buf + m_pos, len);
+    m_pos += len;
+    return len;
+}
+
+static const void *mem_map(int fd, size_t len)
+{
+    if (len > m_size - m_pos)
+        return NULL;
+    const void *data = m_buf + m_pos;
+    m_pos += len;
+    return data;
+}
+
+static tartype_t memtype = {
+    .openfunc   = mem_open,
+    .closefunc  = mem_close,
+    .readfunc   = mem_read,
+    .mapfunc    = mem_map,
+};
+
+static size_t
+list_libtar(void)
+{
+    TAR *t;
+    size_t n = 0;
+
+    if (tar_open(&t, "", &memtype, O_RDONLY, 0, 0) != 0) {
+        perror("tar_open");
+        exit(2);
+    }
+    while (th_read(t) == 0) {
+        n++;
+        if (TH_ISREG(t) && tar_skip_regfile(t) != 0) {
+            perror("tar_skip_regfile");
+            exit(2);
+        }
+    }
+    tar_close(t);
+
+    return n;
+}
+
+static size_t
+list_tarview(void)
+{
+    static struct tarview tv;
+    struct tarview_entry ent;
+    size_t n = 0;
+    int rc;
+
+    tarview_init(&tv, m_buf, m_size);
+    while ((rc = tarview_next(&tv, &ent)) > 0)
+        n++;
+    if (rc < 0) {
+        perror("tarview_next");
+        exit(2);
+    }
+
+    return n;
+}
+
+int
+main(int argc, char **argv)
+{
+    if (argc != 3) {
+        fprintf(stderr, "Usage: %s ARCHIVE RUNS\n", argv[0]);
+        return 2;
+    }
+
+    m_buf = read_file(argv[1], &m_size);
+    int runs = atoi(argv[2]);
+
+    double t_libtar = TIME_BEST(runs, list_libtar());
+    double t_tarview = TIME_BEST(runs, list_tarview());
+    size_t n = list_tarview();
+
+    const char *name = strrchr(argv[1], '/');
+    printf("%s: %zu members\n", name ? name + 1 : argv[1], n);
+    printf("  libtar  %8.1f us\n", t_libtar * 1e6);
+    printf("  tarview %8.1f us\n", t_tarview * 1e6);
+
+    return 0;
+}
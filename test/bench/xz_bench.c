@@ -0,0 +1,92 @@
+/**
+ * Time decoding an .xz file with the bootloader's xz decoder, in
+ * single-call mode (as when the whole archive is decoded at once) and in
+ * multi-call mode with 1 MiB of output per call (as when it is streamed).
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "xz.h"
+#include "bench.h"
+
+#define MULTI_BUFSIZE   (1 << 20)
+
+static const uint8_t *m_in;
+static size_t m_in_size;
+static uint8_t *m_out;
+static size_t m_out_size;
+
+static void
+check(enum xz_ret ret, size_t out_pos)
+{
+    if (ret != XZ_STREAM_END || out_pos != m_out_size) {
+        fprintf(stderr, "Decoding failed: %d\n", ret);
+        exit(2);
+    }
+}
+
+static size_t
+decode_single(void)
+{
+    struct xz_dec *s = xz_dec_init(XZ_SINGLE, 0);
+    struct xz_buf b = {
+        .in = m_in, .in_size = m_in_size,
+        .out = m_out, .out_size = m_out_size,
+    };
+
+    enum xz_ret ret = xz_dec_run(s, &b);
+
+    check(ret, b.out_pos);
+    xz_dec_end(s);
+    return b.out_pos;
+}
+
+static size_t
+decode_multi(void)
+{
+    struct xz_dec *s = xz_dec_init(XZ_DYNALLOC, 1 << 26);
+    struct xz_buf b = {
+        .in = m_in, .in_size = m_in_size,
+        .out = m_out, .out_size = 0,
+    };
+    enum xz_ret ret;
+
+    do {
+        b.out_size = b.out_pos + MULTI_BUFSIZE < m_out_size
+                   ? b.out_pos + MULTI_BUFSIZE : m_out_size;
+        ret = xz_dec_run(s, &b);
+    } while (ret == XZ_OK);
+
+    check(ret, b.out_pos);
+    xz_dec_end(s);
+    return b.out_pos;
+}
+
+int
+main(int argc, char **argv)
+{
+    if (argc != 4) {
+        fprintf(stderr, "Usage: %s FILE.xz SIZE RUNS\n", argv[0]);
+        return 2;
+    }
+
+    xz_crc32_init();
+    xz_crc64_init();
+
+    m_in = read_file(argv[1], &m_in_size);
+    m_out_size = strtoul(argv[2], NULL, 10);
+    m_out = malloc(m_out_size ? m_out_size : 1);
+    int runs = atoi(argv[3]);
+
+    double t_single = TIME_BEST(runs, decode_single());
+    double t_multi = TIME_BEST(runs, decode_multi());
+    double mb = m_out_size / 1e6;
+
+    const char *name = strrchr(argv[1], '/');
+    printf("%s: %zu -> %zu bytes\n", name ? name + 1 : argv[1],
+           m_in_size, m_out_size);
+    printf("  single-call %8.1f ms %8.1f MB/s\n", t_single * 1e3, mb / t_single);
+    printf("  multi-call  %8.1f ms %8.1f MB/s\n", t_multi * 1e3, mb / t_multi);
+
+    return 0;
+}
@@ -16,6 +16,10 @@ staticx $STATICX_FLAGS $(which date) $outfile
 echo -e "\nRunning staticx executable"
 $outfile
 
+# Again, e.g. to use what the first run left in the cache
+echo -e "\nRunning staticx executable again"
+$outfile
+
 if [ -n "$TEST_DOCKER_IMAGE" ]; then
     echo -e "\nRunning staticx executable under $TEST_DOCKER_IMAGE"
     scuba --image $TEST_DOCKER_IMAGE $outfile
@@ -0,0 +1,49 @@
+/**
+ * Check that a library added with -l can be dlopen()ed as soon as the
+ * program starts, and that the bundled copy is the one loaded.
+ *
+ * Usage: dlopen_test NAME SYSTEM_PATH  Exits 0 if dlopen(NAME) loads a
+ *                                      file other than SYSTEM_PATH.
+ */
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <link.h>
+#include <stdio.h>
+#include <sys/stat.h>
+
+int
+main(int argc, char **argv)
+{
+    if (argc != 3) {
+        fprintf(stderr, "Usage: %s NAME SYSTEM_PATH\n", argv[0]);
+        return 2;
+    }
+
+    void *handle = dlopen(argv[1], RTLD_NOW);
+    if (!handle) {
+        fprintf(stderr, "dlopen() failed: %s\n", dlerror());
+        return 1;
+    }
+
+    struct link_map *lm;
+    if (dlinfo(handle, RTLD_DI_LINKMAP, &lm) != 0) {
+        fprintf(stderr, "dlinfo() failed: %s\n", dlerror());
+        return 2;
+    }
+    printf("Loaded %s from %s\n", argv[1], lm->l_name);
+
+    /* Compare the files, not the paths: with memfd, it is a symlink to
+     * /proc/<pid>/fd/N which doesn't resolve to a real path */
+    struct stat loaded, system;
+    if (stat(lm->l_name, &loaded) < 0 || stat(argv[2], &system) < 0) {
+        perror("stat");
+        return 2;
+    }
+
+    if (loaded.st_dev == system.st_dev && loaded.st_ino == system.st_ino) {
+        fprintf(stderr, "%s was loaded from the system, not the bundle\n", argv[1]);
+        return 1;
+    }
+
+    return 0;
+}
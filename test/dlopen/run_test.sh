@@ -0,0 +1,21 @@
+#!/bin/bash
+set -e
+
+echo -e "\n\nTest dlopen() of an additional (-l) library as soon as the program starts"
+
+cd "$(dirname "${BASH_SOURCE[0]}")"
+
+workdir=$(mktemp -d)
+trap "rm -rf $workdir" EXIT
+
+${CC:-cc} -std=gnu99 -Wall -Werror -o $workdir/dlopen_test dlopen_test.c -ldl
+
+# Any library the program doesn't link against will do
+lib=$(${CC:-cc} -print-file-name=libm.so.6)
+outfile=$workdir/dlopen_test.staticx
+
+echo -e "\nMaking staticx executable (\$STATICX_FLAGS=$STATICX_FLAGS):"
+staticx $STATICX_FLAGS -l $lib $workdir/dlopen_test $outfile
+
+echo -e "\nRunning staticx executable"
+$outfile $(basename $lib) $lib
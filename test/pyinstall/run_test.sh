@@ -32,6 +32,10 @@ staticx $STATICX_FLAGS ./dist/app $outfile
 echo -e "\nRunning staticx executable"
 $outfile
 
+# Again, e.g. to use what the first run left in the cache
+echo -e "\nRunning staticx executable again"
+$outfile
+
 # Run it under an old distro
 if [ -n "$TEST_DOCKER_IMAGE" ]; then
     echo -e "\nRunning staticx executable under $TEST_DOCKER_IMAGE"
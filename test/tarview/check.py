@@ -0,0 +1,92 @@
+"""Build tar archives, and print what tarview_test should list for them
+
+Usage: check.py DIR
+
+Writes DIR/<name>.tar and DIR/<name>.expected for each case: a real
+uncompressed archive made by SxArchive, and archives in each tarfile format,
+with names too long for a ustar header.
+"""
+from __future__ import print_function
+import os
+import sys
+import tarfile
+
+sys.path.insert(0, os.path.join(os.path.dirname(__file__), '..', '..'))
+from staticx.archive import SxArchive
+
+
+LONG = 'd' * 60 + '/' + 'n' * 150
+
+
+def listing(path):
+    lines = []
+    with tarfile.open(path) as tar:
+        for m in tar:
+            data = tar.extractfile(m).read() if m.isreg() else b''
+            sum_ = sum(bytearray(data))
+            lines.append('{} {} {} {} {}\n'.format(m.type.decode(), len(data),
+                         sum_, m.name, m.linkname))
+    return ''.join(lines)
+
+
+def make_sxarchive(path, srcdir):
+    prog = os.path.join(srcdir, 'prog')
+    with open(prog, 'wb') as f:
+        f.write(os.urandom(5000))
+
+    lib = os.path.join(srcdir, 'libtest.so.1.0')
+    with open(lib, 'wb') as f:
+        f.write(os.urandom(70000))
+    link = os.path.join(srcdir, 'libtest.so.1')
+    os.symlink('libtest.so.1.0', link)
+
+    with open(path, 'wb') as f:
+        with SxArchive(fileobj=f, mode='w', compress=False) as ar:
+            ar.add_program(prog)
+            ar.add_interp_symlink('/lib/ld-test.so.2')
+            ar.add_library(link)
+
+
+def make_formats(path, fmt, srcdir):
+    src = os.path.join(srcdir, 'data')
+    with open(src, 'wb') as f:
+        f.write(os.urandom(1234))
+
+    kwargs = dict(format=fmt)
+    if fmt == tarfile.PAX_FORMAT:
+        kwargs['pax_headers'] = {'comment': 'global header'}
+
+    with tarfile.open(path, 'w', **kwargs) as tar:
+        tar.add(src, arcname='short')
+        tar.add(src, arcname=LONG)
+
+        t = tarfile.TarInfo('link')
+        t.type = tarfile.SYMTYPE
+        t.linkname = 'l' * 200
+        tar.addfile(t)
+
+        t = tarfile.TarInfo('dir')
+        t.type = tarfile.DIRTYPE
+        tar.addfile(t)
+
+
+def main():
+    outdir = sys.argv[1]
+    srcdir = os.path.join(outdir, 'src')
+    os.mkdir(srcdir)
+
+    cases = [
+        ('sxarchive', lambda p: make_sxarchive(p, srcdir)),
+        ('gnu', lambda p: make_formats(p, tarfile.GNU_FORMAT, srcdir)),
+        ('pax', lambda p: make_formats(p, tarfile.PAX_FORMAT, srcdir)),
+    ]
+    for name, make in cases:
+        path = os.path.join(outdir, name + '.tar')
+        make(path)
+        with open(os.path.join(outdir, name + '.expected'), 'w') as f:
+            f.write(listing(path))
+        print(name)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,19 @@
+#!/bin/bash
+set -e
+
+echo -e "\n\nTest the bootloader's in-place tar reader"
+
+cd "$(dirname "${BASH_SOURCE[0]}")"
+bootloader=../../bootloader
+
+workdir=$(mktemp -d)
+trap "rm -rf $workdir" EXIT
+
+${CC:-cc} -std=gnu99 -Wall -Werror -I$bootloader -o $workdir/tarview_test \
+    tarview_test.c $bootloader/tarview.c
+
+for name in $(python check.py $workdir); do
+    echo -e "\nListing $name.tar:"
+    $workdir/tarview_test $workdir/$name.tar | tee $workdir/$name.out
+    diff -u $workdir/$name.expected $workdir/$name.out
+done
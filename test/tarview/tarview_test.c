@@ -0,0 +1,74 @@
+/**
+ * List the members of a tar archive with the bootloader's tarview, one per
+ * line: type, size, checksum of the contents, name (without the trailing
+ * slash of a directory, as Python's tarfile lists it), and link name.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "tarview.h"
+
+static void *
+read_file(const char *path, size_t *size)
+{
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        perror(path);
+        exit(2);
+    }
+
+    size_t cap = 1 << 16, len = 0, n;
+    char *buf = malloc(cap);
+    while (buf && (n = fread(buf + len, 1, cap - len, f)) > 0) {
+        len += n;
+        if (len == cap)
+            buf = realloc(buf, cap *= 2);
+    }
+    if (!buf) {
+        fprintf(stderr, "Out of memory\n");
+        exit(2);
+    }
+    fclose(f);
+
+    *size = len;
+    return buf;
+}
+
+int
+main(int argc, char **argv)
+{
+    if (argc != 2) {
+        fprintf(stderr, "Usage: %s ARCHIVE\n", argv[0]);
+        return 2;
+    }
+
+    size_t size;
+    void *buf = read_file(argv[1], &size);
+
+    struct tarview tv;
+    struct tarview_entry ent;
+    int rc;
+
+    tarview_init(&tv, buf, size);
+    while ((rc = tarview_next(&tv, &ent)) > 0) {
+        unsigned long sum = 0;
+        for (size_t i = 0; i < ent.size; i++)
+            sum += ((const unsigned char *)ent.data)[i];
+
+        int namelen = strlen(ent.name);
+        while (namelen > 1 && ent.name[namelen - 1] == '/')
+            namelen--;
+
+        printf("%c %zu %lu %.*s %s\n", ent.type, ent.size, sum, namelen,
+               ent.name, ent.linkname);
+    }
+
+    if (rc < 0) {
+        fprintf(stderr, "%s: %s\n", argv[1], strerror(errno));
+        return 1;
+    }
+
+    free(buf);
+    return 0;
+}
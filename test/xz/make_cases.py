@@ -0,0 +1,89 @@
+"""Write .xz test files, and the data they should decode to
+
+Usage: make_cases.py DIR
+
+Prints the name of each case: DIR/<name>.xz decodes to DIR/<name>, or for
+names starting with "corrupt", must be rejected.
+"""
+from __future__ import print_function
+import itertools
+import os
+import random
+import sys
+
+try:
+    import lzma
+except ImportError:
+    from backports import lzma
+
+
+def cases():
+    rand = random.Random(42)
+    noise = bytes(bytearray(rand.getrandbits(8) for _ in range(500000)))
+    text = b''.join(b'line %d of some compressible text\n' % i
+                    for i in range(20000))
+
+    yield 'empty', b''
+    yield 'text', text
+
+    # Incompressible data is stored in LZMA2 uncompressed chunks
+    yield 'stored', noise
+
+    # Compressed and stored chunks in one block
+    yield 'mixed', text + noise + text
+
+    # x86 calls and jumps (E8/E9 and a 32-bit offset), which the BCJ filter
+    # changes, among other code
+    code = bytearray()
+    while len(code) < 500000:
+        if rand.randrange(4) == 0:
+            code += bytearray([rand.choice([0xE8, 0xE9])])
+            code += bytearray(rand.getrandbits(8) for _ in range(3))
+            code += bytearray([rand.choice([0x00, 0xFF])])
+        else:
+            code += bytearray(rand.getrandbits(8) for _ in range(rand.randrange(16)))
+    yield 'code', bytes(code)
+
+
+CHECKS = [
+    ('crc32', lzma.CHECK_CRC32),
+    ('crc64', lzma.CHECK_CRC64),
+    ('none', lzma.CHECK_NONE),
+]
+
+FILTERS = [
+    ('lzma2', [dict(id=lzma.FILTER_LZMA2)]),
+
+    # As the builder compresses bundles for x86-64
+    ('bcj', [dict(id=lzma.FILTER_X86), dict(id=lzma.FILTER_LZMA2)]),
+]
+
+
+def main():
+    outdir = sys.argv[1]
+
+    for (name, data), (filters_name, filters), (check_name, check) in \
+            itertools.product(cases(), FILTERS, CHECKS):
+        case = '{}-{}-{}'.format(name, filters_name, check_name)
+        xz = lzma.compress(data, format=lzma.FORMAT_XZ, check=check,
+                           filters=filters)
+
+        with open(os.path.join(outdir, case), 'wb') as f:
+            f.write(data)
+        with open(os.path.join(outdir, case + '.xz'), 'wb') as f:
+            f.write(xz)
+        print(case)
+
+        # Flip a bit in the data of a stored chunk: only the check can
+        # catch that
+        if name == 'stored' and check != lzma.CHECK_NONE:
+            bad = bytearray(xz)
+            bad[len(bad) // 2] ^= 0x10
+            case = 'corrupt-' + case
+            with open(os.path.join(outdir, case + '.xz'), 'wb') as f:
+                f.write(bytes(bad))
+            print(case)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,22 @@
+#!/bin/bash
+set -e
+
+echo -e "\n\nTest the bootloader's xz decoder"
+
+cd "$(dirname "${BASH_SOURCE[0]}")"
+libxz=../../libxz
+
+workdir=$(mktemp -d)
+trap "rm -rf $workdir" EXIT
+
+${CC:-cc} -std=gnu99 -O2 -Wall -Werror -DXZ_USE_CRC64=1 -DXZ_DEC_X86=1 -I$libxz \
+    -o $workdir/xz_test xz_test.c \
+    $libxz/xz_crc32.c $libxz/xz_crc64.c $libxz/xz_dec_lzma2.c \
+    $libxz/xz_dec_stream.c $libxz/xz_dec_bcj.c
+
+for name in $(python make_cases.py $workdir); do
+    case $name in
+        corrupt-*)  $workdir/xz_test -c $workdir/$name.xz ;;
+        *)          $workdir/xz_test $workdir/$name.xz $workdir/$name ;;
+    esac
+done
@@ -0,0 +1,143 @@
+/**
+ * Decode .xz files with the bootloader's xz decoder, in single-call mode and
+ * in multi-call mode with small buffers, and compare the output with the
+ * expected contents.
+ *
+ * Usage: xz_test FILE.xz EXPECTED   Exits 0 if both modes decode FILE.xz
+ *                                   to EXPECTED.
+ *        xz_test -c FILE.xz         Exits 0 if both modes reject FILE.xz.
+ */
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "xz.h"
+
+#define MULTI_BUFSIZE   1000    /* odd, so chunks straddle buffers */
+
+static uint8_t *
+read_file(const char *path, size_t *size)
+{
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        perror(path);
+        exit(2);
+    }
+
+    size_t cap = 1 << 16, len = 0, n;
+    uint8_t *buf = malloc(cap);
+    while (buf && (n = fread(buf + len, 1, cap - len, f)) > 0) {
+        len += n;
+        if (len == cap)
+            buf = realloc(buf, cap *= 2);
+    }
+    if (!buf) {
+        fprintf(stderr, "Out of memory\n");
+        exit(2);
+    }
+    fclose(f);
+
+    *size = len;
+    return buf;
+}
+
+static enum xz_ret
+decode_single(const uint8_t *in, size_t in_size, uint8_t *out, size_t out_size)
+{
+    struct xz_dec *s = xz_dec_init(XZ_SINGLE, 0);
+    struct xz_buf b = {
+        .in = in, .in_size = in_size,
+        .out = out, .out_size = out_size,
+    };
+
+    enum xz_ret ret = xz_dec_run(s, &b);
+    if (ret == XZ_STREAM_END && b.out_pos != out_size)
+        ret = XZ_DATA_ERROR;
+    xz_dec_end(s);
+    return ret;
+}
+
+static enum xz_ret
+decode_multi(const uint8_t *in, size_t in_size, uint8_t *out, size_t out_size)
+{
+    struct xz_dec *s = xz_dec_init(XZ_DYNALLOC, 1 << 26);
+    uint8_t buf[MULTI_BUFSIZE];
+    struct xz_buf b = {
+        .in = in, .in_size = 0,
+        .out = buf, .out_size = sizeof(buf),
+    };
+    size_t pos = 0;
+    enum xz_ret ret;
+
+    do {
+        /* Feed the input in small pieces too */
+        b.in_size = in_size - b.in_pos < MULTI_BUFSIZE
+                  ? in_size : b.in_pos + MULTI_BUFSIZE;
+        b.out_pos = 0;
+
+        ret = xz_dec_run(s, &b);
+
+        if (b.out_pos > out_size - pos) {
+            ret = XZ_DATA_ERROR;
+            break;
+        }
+        memcpy(out + pos, buf, b.out_pos);
+        pos += b.out_pos;
+    } while (ret == XZ_OK);
+
+    if (ret == XZ_STREAM_END && pos != out_size)
+        ret = XZ_DATA_ERROR;
+    xz_dec_end(s);
+    return ret;
+}
+
+int
+main(int argc, char **argv)
+{
+    bool expect_error = argc == 3 && strcmp(argv[1], "-c") == 0;
+    if (argc != 3) {
+        fprintf(stderr, "Usage: %s FILE.xz EXPECTED | -c FILE.xz\n", argv[0]);
+        return 2;
+    }
+
+    xz_crc32_init();
+    xz_crc64_init();
+
+    size_t in_size, expected_size = 0;
+    uint8_t *in = read_file(argv[expect_error ? 2 : 1], &in_size);
+    uint8_t *expected = expect_error ? NULL : read_file(argv[2], &expected_size);
+
+    /* A corrupt file may decode to about as much as expected */
+    size_t out_size = expect_error ? in_size * 2 + 4096 : expected_size;
+    uint8_t *out = malloc(out_size ? out_size : 1);
+
+    static const struct {
+        const char *name;
+        enum xz_ret (*decode)(const uint8_t *, size_t, uint8_t *, size_t);
+    } modes[] = {
+        { "single-call", decode_single },
+        { "multi-call", decode_multi },
+    };
+
+    int rc = 0;
+    for (size_t i = 0; i < sizeof(modes) / sizeof(modes[0]); i++) {
+        memset(out, 0, out_size);
+        enum xz_ret ret = modes[i].decode(in, in_size, out, out_size);
+
+        bool ok;
+        if (expect_error)
+            ok = ret != XZ_STREAM_END;
+        else
+            ok = ret == XZ_STREAM_END && memcmp(out, expected, out_size) == 0;
+
+        printf("%s: %s: %s (%d)\n", argv[expect_error ? 2 : 1],
+               modes[i].name, ok ? "ok" : "FAIL", ret);
+        if (!ok)
+            rc = 1;
+    }
+
+    free(out);
+    free(expected);
+    free(in);
+    return rc;
+}